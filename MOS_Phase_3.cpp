@@ -10,8 +10,32 @@
 #include <stdexcept>
 #include <bitset>
 #include <mutex>
-#include <functional>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <new>
+#include <cstdint>
 #include <string.h>
+#include <type_traits>
+#include <chrono>
+#include <map>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <csignal>
+#include <cerrno>
+#include <functional>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 using namespace std;
 
@@ -19,37 +43,118 @@ using namespace std;
 class MOS;
 struct PCB;
 
+// Default frame count; override with -DMOS_FRAME_COUNT= for a specialized
+// build, or per run through MemoryGeometry
+#ifndef MOS_FRAME_COUNT
+#define MOS_FRAME_COUNT 10
+#endif
+
+// The threaded interpreter dispatches with computed goto where the compiler
+// has labels as values (GCC, Clang), and with a switch elsewhere or when
+// built with -DMOS_COMPUTED_GOTO=0
+#ifndef MOS_COMPUTED_GOTO
+#ifdef __GNUC__
+#define MOS_COMPUTED_GOTO 1
+#else
+#define MOS_COMPUTED_GOTO 0
+#endif
+#endif
+
 // Constants
-const int MEM_SIZE = 100;
-const int PAGE_SIZE = 10;
-const int FRAME_COUNT = 10;
 const int WORD_SIZE = 4;
+const int VIRTUAL_MEM_SIZE = 100; // operands are two digits, so VA is 00-99
+// The page a deck sees: GD reads a card into one, PD prints one, and an
+// access faults page by page. Only --extended-isa runs may change it.
+const int DECK_PAGE_SIZE = 10;
+const int CACHE_LINE = 64;
 const int MAX_TIMER = 1000000;
 const int NUM_INTERRUPTS = 8;
+const int TLB_SIZE = 8; // must be a power of two
+const int BLOCK_CACHE_SIZE = 256; // translated blocks per CPU, a power of two
+
+// A word is WORD_SIZE characters, exactly one uint32_t, so LR, SR, CR and
+// fetches move and compare it with one packed load and store
+typedef uint32_t PackedWord;
+static_assert(sizeof(PackedWord) == WORD_SIZE, "a word must pack into one PackedWord");
+
+inline PackedWord loadWord(const char* word) {
+    PackedWord value;
+    memcpy(&value, word, sizeof value);
+    return value;
+}
+inline void storeWord(char* word, PackedWord value) { memcpy(word, &value, sizeof value); }
+inline void copyWord(char* dst, const char* src) { storeWord(dst, loadWord(src)); }
+inline bool sameWord(const char* a, const char* b) { return loadWord(a) == loadWord(b); }
+
+// Whole-frame clear and copy, 16 bytes per SSE2 store and the rest a word
+// at a time. Frames are a few dozen bytes, too small to pay for a call
+// into memset or memcpy.
+inline void clearBytes(char* dst, size_t bytes) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= bytes; i += 16) _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), zero);
+#endif
+    for (; i + WORD_SIZE <= bytes; i += WORD_SIZE) storeWord(dst + i, 0);
+    for (; i < bytes; i++) dst[i] = '\0';
+}
+
+inline void copyBytes(char* dst, const char* src, size_t bytes) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), chunk);
+    }
+#endif
+    for (; i + WORD_SIZE <= bytes; i += WORD_SIZE) copyWord(dst + i, src + i);
+    for (; i < bytes; i++) dst[i] = src[i];
+}
 
 // Error and Interrupt Codes
 enum EM_Code { 
     EM_NO_ERR, EM_OUT_OF_DATA, EM_LINE_LIMIT, EM_TIME_LIMIT, 
-    EM_OP_CODE_ERR, EM_OPERAND_ERR, EM_INVALID_PAGE 
+    EM_OP_CODE_ERR, EM_OPERAND_ERR, EM_INVALID_PAGE,
+    EM_MEMORY_LIMIT // turned away at admission, it can never fit in memory
 };
 
 enum SI_Type { READ=1, WRITE=2, TERM=3 };
+
+const char* terminationMessage(EM_Code code) {
+    switch (code) {
+        case EM_NO_ERR: return "Normal termination";
+        case EM_OUT_OF_DATA: return "Out of data";
+        case EM_LINE_LIMIT: return "Line limit exceeded";
+        case EM_TIME_LIMIT: return "Time limit exceeded";
+        case EM_OP_CODE_ERR: return "Invalid operation code";
+        case EM_OPERAND_ERR: return "Invalid operand";
+        case EM_INVALID_PAGE: return "Invalid page access";
+        case EM_MEMORY_LIMIT: return "Job exceeds memory";
+    }
+    return "";
+}
 enum PI_Type { PI_OP_ERR=1, PI_OPERAND_ERR=2, PI_PAGE_FAULT=3 };
 
-// Interrupt priorities (higher number = higher priority)
-enum InterruptPriority {
-    PRIORITY_TIMER = 3,    
-    PRIORITY_PAGE_FAULT = 2,
-    PRIORITY_PROGRAM = 1,  // Program errors
-    PRIORITY_SYSCALL = 0   
+// Pending-interrupt bits, ordered by priority: the highest set bit is the
+// one dispatched. Timer beats page faults, page faults beat the other
+// program errors and those beat system calls. PCB::interruptMask uses the
+// same bit numbers.
+enum InterruptBit {
+    IRQ_SI_READ = 0,
+    IRQ_SI_WRITE,
+    IRQ_SI_TERM,
+    IRQ_PI_OP_ERR,
+    IRQ_PI_OPERAND_ERR,
+    IRQ_PI_PAGE_FAULT,
+    IRQ_TIMER,
+    IRQ_COUNT
 };
+static_assert(IRQ_COUNT <= NUM_INTERRUPTS, "interrupt bits must fit PCB::interruptMask");
 
-// Interrupt Vector Table Entry
-struct InterruptVectorEntry {
-    int type;  // SI_Type or PI_Type
-    int priority;
-    function<void()> handler;  
-};
+const char* interruptName(int irq) {
+    static const char* const names[IRQ_COUNT] = {"read", "write", "term", "op_err", "operand_err", "page_fault", "timer"};
+    return irq >= 0 && irq < IRQ_COUNT ? names[irq] : "?";
+}
 
 // CPU State
 struct CPUState {
@@ -61,12 +166,214 @@ struct CPUState {
     int PI = 0;
     int TI = 0;
     int RA = 0; // real address
+    int moved = 0; // pages an interrupted MV has already copied
+};
+static_assert(is_trivially_copyable<CPUState>::value, "context switches memcpy CPUState");
+
+// Decoded operation codes. AD to MV are the extended set, decoded only
+// with --extended-isa; a legacy deck gets an operation code error for them.
+enum OpCode : unsigned char {
+    OP_INVALID, OP_GD, OP_PD, OP_H, OP_LR, OP_SR, OP_CR, OP_BT,
+    OP_AD, OP_SB, OP_CL, OP_BU, OP_MV
+};
+const int OP_COUNT = OP_MV + 1;
+
+const char* opCodeName(int op) {
+    static const char* const names[] = {"invalid", "GD", "PD", "H", "LR", "SR", "CR", "BT",
+                                        "AD", "SB", "CL", "BU", "MV"};
+    return op >= OP_INVALID && op < OP_COUNT ? names[op] : "?";
+}
+
+// Pre-decoded form of a memory word, so execution never re-parses text
+struct DecodedInstr {
+    OpCode op = OP_INVALID;
+    int operand = -1; // -1 when the operand field is not a number
 };
 
+// Decode a raw WORD_SIZE word ("GD10", "H   ", ...) into opcode + operand
+DecodedInstr decodeWord(const char* word, bool extended) {
+    DecodedInstr d;
+    char op[2];
+    int opLen = 0;
+    int operand = 0;
+    int digits = 0;
+    bool numeric = true;
+
+    for (int i = 0; i < WORD_SIZE; i++) {
+        char c = word[i];
+        if (c == '\0' || isspace(static_cast<unsigned char>(c))) continue;
+        if (i < 2) {
+            op[opLen++] = c;
+        } else if (c >= '0' && c <= '9') {
+            operand = operand * 10 + (c - '0');
+            digits++;
+        } else {
+            numeric = false;
+        }
+    }
+
+    if (opLen == 1 && op[0] == 'H') {
+        d.op = OP_H;
+        return d;
+    }
+    if (opLen != 2) return d;
+
+    if (op[0] == 'G' && op[1] == 'D') d.op = OP_GD;
+    else if (op[0] == 'P' && op[1] == 'D') d.op = OP_PD;
+    else if (op[0] == 'L' && op[1] == 'R') d.op = OP_LR;
+    else if (op[0] == 'S' && op[1] == 'R') d.op = OP_SR;
+    else if (op[0] == 'C' && op[1] == 'R') d.op = OP_CR;
+    else if (op[0] == 'B' && op[1] == 'T') d.op = OP_BT;
+    else if (!extended) return d;
+    else if (op[0] == 'A' && op[1] == 'D') d.op = OP_AD;
+    else if (op[0] == 'S' && op[1] == 'B') d.op = OP_SB;
+    else if (op[0] == 'C' && op[1] == 'L') d.op = OP_CL;
+    else if (op[0] == 'B' && op[1] == 'U') d.op = OP_BU;
+    else if (op[0] == 'M' && op[1] == 'V') d.op = OP_MV;
+    else return d;
+
+    d.operand = (numeric && digits > 0) ? operand : -1;
+    return d;
+}
+
+// The extended arithmetic reads a word as a signed decimal number, blanks
+// allowed around it: "12  ", "0012", "-7". An all-blank word is 0.
+const int WORD_MIN = -999;
+const int WORD_MAX = 9999;
+
+bool wordValue(const char* word, int& value) {
+    int i = 0;
+    while (i < WORD_SIZE && (word[i] == ' ' || word[i] == '\0')) i++;
+    bool negative = i < WORD_SIZE && word[i] == '-';
+    if (negative) i++;
+    int digits = 0;
+    value = 0;
+    for (; i < WORD_SIZE && word[i] >= '0' && word[i] <= '9'; i++, digits++) value = value * 10 + (word[i] - '0');
+    while (i < WORD_SIZE && (word[i] == ' ' || word[i] == '\0')) i++;
+    if (i < WORD_SIZE || (negative && digits == 0)) return false;
+    if (negative) value = -value;
+    return true;
+}
+
+// Zero-padded to the full word, "0042" or "-042"; false when out of range
+bool setWordValue(char* word, int value) {
+    if (value < WORD_MIN || value > WORD_MAX) return false;
+    int magnitude = value < 0 ? -value : value;
+    for (int i = WORD_SIZE - 1; i >= 0; i--, magnitude /= 10) word[i] = char('0' + magnitude % 10);
+    if (value < 0) word[0] = '-';
+    return true;
+}
+
+// Kind of memory access, decides whether a page fault can be serviced
+enum AccessType { ACCESS_FETCH, ACCESS_READ, ACCESS_WRITE };
+
 // Page Table Entry
 struct PageTableEntry {
     int frame;
     bool valid;
+    bool referenced = false;  // touched since the clock hand last passed
+    bool dirty = false;       // written since it was loaded
+    int swapSlot = -1;        // drum slot holding the page, -1 if none
+    long long lastUsed = 0;   // globalTimer of the last access, for LRU
+    bool shared = false;      // program page other jobs may map too; copied before a write
+};
+
+// Translation lookaside buffer entry, tagged with the owning job's
+// address-space id (PCB::deckSeq)
+struct TLBEntry {
+    long long asid = -1;
+    int page = -1;
+    int frame = -1;
+    PageTableEntry* pte = nullptr; // so hits still maintain referenced/dirty bits
+};
+
+// Direct-mapped software TLB; address-space tags mean a context switch needs no flush
+struct TLB {
+    TLBEntry entries[TLB_SIZE];
+    long long hits = 0;
+    long long misses = 0;
+
+    static int slot(long long asid, int page) {
+        return (page ^ (int)(asid * 7)) & (TLB_SIZE - 1);
+    }
+
+    const TLBEntry* lookup(long long asid, int page) {
+        const TLBEntry& e = entries[slot(asid, page)];
+        if (e.asid == asid && e.page == page) {
+            hits++;
+            return &e;
+        }
+        misses++;
+        return nullptr;
+    }
+
+    // Lookup without counting; the caller counts the hits it uses
+    const TLBEntry* probe(long long asid, int page) const {
+        const TLBEntry& e = entries[slot(asid, page)];
+        return e.asid == asid && e.page == page ? &e : nullptr;
+    }
+
+    void insert(long long asid, int page, int frame, PageTableEntry* pte) {
+        entries[slot(asid, page)] = TLBEntry{asid, page, frame, pte};
+    }
+
+    // Drop one translation (the page was evicted)
+    void invalidate(long long asid, int page) {
+        TLBEntry& e = entries[slot(asid, page)];
+        if (e.asid == asid && e.page == page) e = TLBEntry{};
+    }
+
+    // Drop every translation owned by asid (its frames are being released)
+    void flushProcess(long long asid) {
+        for (auto& e : entries) {
+            if (e.asid == asid) e = TLBEntry{};
+        }
+    }
+
+    void flush() {
+        for (auto& e : entries) e = TLBEntry{};
+    }
+};
+
+// A straight run of LR/SR/CR/BT within one code page, with every operand
+// already translated to a real address. It ends after a BT or after an SR
+// into its own code page, and before anything else.
+struct TranslatedBlock {
+    struct Op {
+        OpCode op;
+        int realAddr;
+        int target; // BT: the VA to jump to
+    };
+    // A page the block touches, and the last op that touches it
+    struct Page {
+        int page;
+        int frame;
+        int lastOp;
+        bool written;
+        PageTableEntry* pte; // from the TLB when the block is entered
+    };
+
+    long long asid = -1;   // PCB::deckSeq of the job it was translated for
+    int startVA = -1;
+    int codeFrame = -1;    // code seen at startVA: its frame
+    unsigned codeGen = 0;  // and Memory::frameGen of that frame
+    bool translated = false; // ops and pages are built for that code
+    int waitPage = -1;     // non-resident operand page that cut the block short
+    int endVA = 0;         // IC after the block when no BT is taken
+    int lastFetch = 0;     // real address of the last op, for IR
+    vector<Op> ops;
+    vector<Page> pages;
+};
+
+// Per-CPU translation cache, direct-mapped on (address-space id, start VA)
+struct BlockCache {
+    TranslatedBlock blocks[BLOCK_CACHE_SIZE];
+    long long translations = 0;
+    long long runs = 0;
+
+    TranslatedBlock& slot(long long asid, int va) {
+        return blocks[(va ^ (int)(asid * 31)) & (BLOCK_CACHE_SIZE - 1)];
+    }
 };
 
 // Process states for context switching
@@ -77,882 +384,4357 @@ enum ProcessState {
     TERMINATED
 };
 
-// Memory structure
-struct Memory {
-    char data[MEM_SIZE][WORD_SIZE];
-    bool allocated[FRAME_COUNT] = {false};
-    bitset<FRAME_COUNT> locked_frames;
-    
-    void clearFrame(int frame) {
-        fill_n(data[frame*PAGE_SIZE], PAGE_SIZE*WORD_SIZE, '\0');
-    }
+// Memory geometry, fixed for the lifetime of a MOS instance
+struct MemoryGeometry {
+    int pageSize = DECK_PAGE_SIZE;    // words per page/frame
+    int frameCount = MOS_FRAME_COUNT; // physical frames
 
-    void lockFrame(int frame) {
-        locked_frames.set(frame);
-    }
+    int memSize() const { return pageSize * frameCount; }
+    int pagesPerProcess() const { return (VIRTUAL_MEM_SIZE + pageSize - 1) / pageSize; }
+};
 
-    void unlockFrame(int frame) {
-        locked_frames.reset(frame);
+// One bit per frame, sized at startup
+struct FrameBitmap {
+    vector<uint64_t> bits;
+
+    void resize(int count) { bits.assign((count + 63) / 64, 0); }
+    bool test(int i) const { return (bits[i >> 6] >> (i & 63)) & 1; }
+    void set(int i) { bits[i >> 6] |= uint64_t(1) << (i & 63); }
+    void reset(int i) { bits[i >> 6] &= ~(uint64_t(1) << (i & 63)); }
+    int count() const {
+        int n = 0;
+        for (uint64_t word : bits) n += __builtin_popcountll(word);
+        return n;
     }
 };
 
-// Process Context for context switching
-struct ProcessContext {
-    int registers[8];
-    int programCounter;
-    int stackPointer;
-    int statusRegister;
-    ProcessState state;
+// Frees a cache-line aligned backing store
+struct AlignedDelete {
+    void operator()(char* p) const { ::operator delete[](p, align_val_t(CACHE_LINE)); }
 };
 
-// Enhanced PCB with context information
-struct PCB {
-    int pid;
-    int TTL;
-    int TLL;
-    int TTC = 0;
-    int LLC = 0;
-    PageTableEntry pageTable[FRAME_COUNT];
-    int PTR;
-    vector<string> dataCards;
-    bool terminated = false;
-    ProcessContext context;
-    int priority;
-    bitset<NUM_INTERRUPTS> interruptMask;
-};
+// Memory structure
+struct Memory {
+    int pageSize = 0;
+    int frameCount = 0;
+    int size = 0; // in words
 
-void debugPrint(const string& msg) {
-    cout << "[DEBUG] " << msg << endl;
-}
+    // Contiguous, cache-line aligned word store; data[RA] is one word
+    unique_ptr<char[], AlignedDelete> store;
+    char (*data)[WORD_SIZE] = nullptr;
 
-class MOS {
-private:
-    Memory mem;
-    queue<PCB*> readyQueue;
-    PCB* currentPCB = nullptr;
-    CPUState cpu;
-    ifstream inFile;
-    ofstream outFile;
-    int globalTimer = 0;
-    bool systemRunning = true;
-    bool interruptsEnabled = true;
+    FrameBitmap allocated;
+    FrameBitmap locked_frames; // frames with a nonzero pinCount
+    vector<int> pinCount;      // page-table, in-flight I/O and copy-source pins
+    int freeFrames = 0;
+
+    // Decode cache, one entry per word; stale entries are re-decoded on fetch
+    vector<DecodedInstr> decoded;
+    vector<unsigned char> decodedValid;
+    // Bumped by every store to a frame, so a translated block can tell
+    // that the code it was built from changed
+    vector<unsigned> frameGen;
+    // Page tables mapping each frame; above 1 only for shared program pages
+    vector<int> refCount;
+    bool extendedISA = false; // decode the AD..MV opcodes
+
+    void init(const MemoryGeometry& geometry) {
+        pageSize = geometry.pageSize;
+        frameCount = geometry.frameCount;
+        size = geometry.memSize();
+
+        size_t bytes = size_t(size) * WORD_SIZE;
+        store.reset(static_cast<char*>(::operator new[](bytes, align_val_t(CACHE_LINE))));
+        fill_n(store.get(), bytes, '\0');
+        data = reinterpret_cast<char (*)[WORD_SIZE]>(store.get());
+
+        allocated.resize(frameCount);
+        locked_frames.resize(frameCount);
+        pinCount.assign(frameCount, 0);
+        freeFrames = frameCount;
+        decoded.assign(size, DecodedInstr{});
+        decodedValid.assign(size, 0);
+        frameGen.assign(frameCount, 0);
+        refCount.assign(frameCount, 0);
+    }
     
-    // Interrupt Vector Table
-    vector<InterruptVectorEntry> interruptVectorTable;
+    int pagesPerProcess() const { return (VIRTUAL_MEM_SIZE + pageSize - 1) / pageSize; }
     
-    // Hardware ISR state
-    struct HardwareISR {
-        bool diskReady = false;
-        bool printerReady = false;
-        bool networkReady = false;
-        queue<string> diskBuffer;
-        queue<string> printerBuffer;
-        queue<string> networkBuffer;
-    } hardwareISR;
+    void clearFrame(int frame) {
+        clearBytes(data[frame*pageSize], pageSize*WORD_SIZE);
+        clearBytes(reinterpret_cast<char*>(&decodedValid[frame*pageSize]), pageSize);
+        frameGen[frame]++;
+    }
 
-    // Critical section lock
-    mutex criticalSectionLock;
+    // All stores go through here so the decode cache never goes stale
+    void writeWord(int addr, const char* word) {
+        writeWord(addr, addr / pageSize, word);
+    }
 
-    // Initialize interrupt vector table
-    void initInterruptVectorTable() {
-        // Timer interrupts
-        interruptVectorTable.push_back(InterruptVectorEntry{
-            0, 
-            PRIORITY_TIMER, 
-            bind(&MOS::handleTimerInterrupt, this)
-        });
-        
-        // Program interrupts
-        interruptVectorTable.push_back(InterruptVectorEntry{
-            PI_OP_ERR, 
-            PRIORITY_PROGRAM, 
-            bind(&MOS::handleOpCodeError, this)
-        });
-        
-        interruptVectorTable.push_back(InterruptVectorEntry{
-            PI_OPERAND_ERR, 
-            PRIORITY_PROGRAM, 
-            bind(&MOS::handleOperandError, this)
-        });
-        
-        interruptVectorTable.push_back(InterruptVectorEntry{
-            PI_PAGE_FAULT, 
-            PRIORITY_PAGE_FAULT, 
-            bind(&MOS::handlePageFault, this)
-        });
-        
-        // System call interrupts
-        interruptVectorTable.push_back(InterruptVectorEntry{
-            READ, 
-            PRIORITY_SYSCALL, 
-            bind(&MOS::handleRead, this)
-        });
-        
-        interruptVectorTable.push_back(InterruptVectorEntry{
-            WRITE, 
-            PRIORITY_SYSCALL, 
-            bind(&MOS::handleWrite, this)
-        });
-        
-        interruptVectorTable.push_back(InterruptVectorEntry{
-            TERM, 
-            PRIORITY_SYSCALL, 
-            bind(&MOS::handleTerminate, this)
-        });
+    // Same, for callers that already know the frame
+    void writeWord(int addr, int frame, const char* word) {
+        copyWord(data[addr], word);
+        decodedValid[addr] = false;
+        frameGen[frame]++;
     }
 
-    // Hardware ISR handlers
-    void handleDiskInterrupt() {
-        lock_guard<mutex> lock(criticalSectionLock);
-        if (!hardwareISR.diskBuffer.empty()) {
-            string data = hardwareISR.diskBuffer.front();
-            hardwareISR.diskBuffer.pop();
-            // Process disk data
-            debugPrint("Processing disk data: " + data);
-        }
-        hardwareISR.diskReady = true;
+    // Store up to WORD_SIZE characters, padding the rest of the word with spaces
+    void writeChars(int addr, const char* src, size_t len) {
+        len = min(len, static_cast<size_t>(WORD_SIZE));
+        copy(src, src + len, data[addr]);
+        fill(data[addr] + len, data[addr] + WORD_SIZE, ' ');
+        decodedValid[addr] = false;
+        frameGen[addr / pageSize]++;
     }
 
-    void handlePrinterInterrupt() {
-        lock_guard<mutex> lock(criticalSectionLock);
-        if (!hardwareISR.printerBuffer.empty()) {
-            string data = hardwareISR.printerBuffer.front();
-            hardwareISR.printerBuffer.pop();
-            outFile << data << endl;
-            debugPrint("Printed data: " + data);
+    // Write an instruction word and decode it eagerly
+    void storeInstruction(int addr, const char* word) {
+        copyWord(data[addr], word);
+        decoded[addr] = decodeWord(word, extendedISA);
+        decodedValid[addr] = true;
+        frameGen[addr / pageSize]++;
+    }
+
+    const DecodedInstr& fetchDecoded(int addr) {
+        if (!decodedValid[addr]) {
+            decoded[addr] = decodeWord(data[addr], extendedISA);
+            decodedValid[addr] = true;
         }
-        hardwareISR.printerReady = true;
+        return decoded[addr];
     }
 
-    void handleNetworkInterrupt() {
-        lock_guard<mutex> lock(criticalSectionLock);
-        if (!hardwareISR.networkBuffer.empty()) {
-            string data = hardwareISR.networkBuffer.front();
-            hardwareISR.networkBuffer.pop();
-            // Process network data
-            debugPrint("Processing network data: " + data);
+    // First frame at or after start (wrapping) that is neither allocated
+    // nor locked; scans 64 frames per step. Returns -1 when memory is full.
+    int findFreeFrame(int start) const {
+        if (freeFrames == 0) return -1;
+        int words = (int)allocated.bits.size();
+        int w = start >> 6;
+        uint64_t busy = allocated.bits[w] | locked_frames.bits[w];
+        uint64_t candidates = ~busy & (~uint64_t(0) << (start & 63));
+        for (int step = 0; step <= words; step++) {
+            if (candidates) {
+                int frame = (w << 6) + __builtin_ctzll(candidates);
+                if (frame < frameCount) return frame;
+            }
+            w = (w + 1 == words) ? 0 : w + 1;
+            candidates = ~(allocated.bits[w] | locked_frames.bits[w]);
         }
-        hardwareISR.networkReady = true;
+        return -1;
     }
 
-    // Interrupt handlers
-    void handleTimerInterrupt() {
-        debugPrint("Time limit interrupt");
-        terminate(EM_TIME_LIMIT);
+    void claimFrame(int frame) {
+        allocated.set(frame);
+        freeFrames--;
+        refCount[frame] = 1;
     }
 
-    void handleOpCodeError() {
-        debugPrint("Operation code error");
-        terminate(EM_OP_CODE_ERR);
+    void share(int frame) { refCount[frame]++; }
+    // Drop one mapping; once this reaches 0 the frame can be released
+    int unshare(int frame) { return --refCount[frame]; }
+
+    // Return a frame to the pool, wiping it for the next owner
+    void releaseFrame(int frame) {
+        if (!allocated.test(frame)) return;
+        allocated.reset(frame);
+        freeFrames++;
+        refCount[frame] = 0;
+        clearFrame(frame);
+        pinCount[frame] = 0;
+        locked_frames.reset(frame);
     }
 
-    void handleOperandError() {
-        debugPrint("Operand error");
-        terminate(EM_OPERAND_ERR);
+    // Fill a whole frame from a saved page image
+    void loadFrame(int frame, const char* src) {
+        copyBytes(data[frame*pageSize], src, pageSize*WORD_SIZE);
+        clearBytes(reinterpret_cast<char*>(&decodedValid[frame*pageSize]), pageSize);
+        frameGen[frame]++;
     }
 
-    void handlePageFault() {
-        debugPrint("Page fault");
-        terminate(EM_INVALID_PAGE);
+    // Pins nest: a frame is only evictable again once every lockFrame()
+    // has been matched by an unlockFrame()
+    void lockFrame(int frame) {
+        if (pinCount[frame]++ == 0) locked_frames.set(frame);
     }
 
-    void handleTerminate() {
-        debugPrint("Terminate system call");
-        terminate(EM_NO_ERR);
+    void unlockFrame(int frame) {
+        if (pinCount[frame] > 0 && --pinCount[frame] == 0) locked_frames.reset(frame);
     }
+};
 
-    
+// Simulated drum backing store: page-sized slots, recycled through a free list
+struct SwapStore {
+    int slotBytes = 0;
+    vector<char> drum;
+    vector<int> freeSlots;
 
-    void saveContext() {
-        if(currentPCB) {
-            currentPCB->context.state = BLOCKED;
-            currentPCB->context.programCounter = cpu.IC;
-            // Save other CPU state
-            for(int i = 0; i < 8; i++) {
-                currentPCB->context.registers[i] = 0; // Save actual register values here
-            }
-            currentPCB->context.stackPointer = 0; // Save actual SP
-            currentPCB->context.statusRegister = 0; // Save status flags
-        }
-    }
+    void init(int pageSize) { slotBytes = pageSize * WORD_SIZE; }
 
-    void restoreContext() {
-        if (currentPCB) {
-            currentPCB->context.state = RUNNING;
-    
-            // Check if this process is being executed for the first time
-            if (currentPCB->context.programCounter == -1) {
-                debugPrint("First-time execution: setting IC to 0");
-                cpu.IC = 0;  // Start from beginning
-            } else {
-                cpu.IC = currentPCB->context.programCounter;
-                debugPrint("Restoring IC from context: IC = " + to_string(cpu.IC));
-            }
-    
-            // Restore additional CPU state if needed
-            // Example: Restore general-purpose registers
-            
-            
+    int allocSlot() {
+        if (!freeSlots.empty()) {
+            int slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
         }
+        drum.resize(drum.size() + slotBytes);
+        return (int)(drum.size() / slotBytes) - 1;
     }
-    
 
-    void handleInterrupt() {
-        if (!interruptsEnabled) return;
+    void freeSlot(int slot) { freeSlots.push_back(slot); }
+    char* slotData(int slot) { return drum.data() + size_t(slot) * slotBytes; }
+};
 
-        // Find highest priority pending interrupt
-        int highestPriority = -1;
-        InterruptVectorEntry* highestPriorityEntry = nullptr;
+// Victim selection once every frame is in use
+enum ReplacementPolicy {
+    REPLACE_NONE,  // allocation fails when memory is full
+    REPLACE_FIFO,  // oldest loaded page
+    REPLACE_LRU,   // least recently accessed page
+    REPLACE_CLOCK  // second chance on the referenced bit
+};
 
-        // Check timer interrupt first (highest priority)
-        if (cpu.TI) {
-            highestPriorityEntry = &interruptVectorTable[0]; // Timer interrupt is first in table
-            highestPriority = highestPriorityEntry->priority;
-        }
+const char* replacementName(ReplacementPolicy policy) {
+    switch (policy) {
+        case REPLACE_FIFO: return "fifo";
+        case REPLACE_LRU: return "lru";
+        case REPLACE_CLOCK: return "clock";
+        default: return "none";
+    }
+}
 
-        // Check program interrupts
-        if (cpu.PI) {
-            for (auto& entry : interruptVectorTable) {
-                if (entry.type == cpu.PI && entry.priority > highestPriority) {
-                    highestPriority = entry.priority;
-                    highestPriorityEntry = &entry;
-                }
-            }
-        }
+bool parseReplacement(const string& name, ReplacementPolicy& policy) {
+    if (name == "none") policy = REPLACE_NONE;
+    else if (name == "fifo") policy = REPLACE_FIFO;
+    else if (name == "lru") policy = REPLACE_LRU;
+    else if (name == "clock") policy = REPLACE_CLOCK;
+    else return false;
+    return true;
+}
 
-        // Check system call interrupts
-        if (cpu.SI) {
-            for (auto& entry : interruptVectorTable) {
-                if (entry.type == cpu.SI && entry.priority > highestPriority) {
-                    highestPriority = entry.priority;
-                    highestPriorityEntry = &entry;
-                }
-            }
-        }
+// Where --perf writes its counter records
+enum PerfFormat {
+    PERF_OFF,
+    PERF_JSON, // one JSON array of records
+    PERF_CSV   // one row per record, under a header
+};
 
-        // Handle the highest priority interrupt
-        if (highestPriorityEntry) {
-            // Save context before handling interrupt
-            saveContext();
-            
-            // Call the appropriate handler
-            highestPriorityEntry->handler();
-            
-            // Clear the interrupt
-            if (highestPriorityEntry->type == 0) cpu.TI = 0;
-            else if (highestPriorityEntry->type == cpu.PI) cpu.PI = 0;
-            else if (highestPriorityEntry->type == cpu.SI) cpu.SI = 0;
-            
-            // Restore context after handling interrupt
-            restoreContext();
-        }
+const char* perfFormatName(PerfFormat format) {
+    switch (format) {
+        case PERF_JSON: return "json";
+        case PERF_CSV: return "csv";
+        default: return "off";
     }
+}
 
-    // Memory management
-    int allocateFrame() {
-        random_device rd;
-        mt19937 gen(rd());
-        uniform_int_distribution<> dist(0, FRAME_COUNT-1);
-        
-        for(int attempts = 0; attempts < FRAME_COUNT*2; attempts++) {
-            int frame = dist(gen);
-            if (!mem.allocated[frame]) {
-                mem.allocated[frame] = true;
-                return frame;
-            }
-        }
-        return -1;
-    }
+bool parsePerfFormat(const string& name, PerfFormat& format) {
+    if (name == "off") format = PERF_OFF;
+    else if (name == "json") format = PERF_JSON;
+    else if (name == "csv") format = PERF_CSV;
+    else return false;
+    return true;
+}
 
-    // Address translation
-    bool addressMap(int VA, int& RA) {
-        // Step 1: Validate virtual address range
-        if (VA < 0 || VA >= MEM_SIZE) {
-            debugPrint("Invalid VA: " + to_string(VA));
-            cpu.PI = PI_OPERAND_ERR;
-            return false;
-        }
-    
-        // Step 2: Calculate page and offset
-        int page = VA / PAGE_SIZE;
-        int offset = VA % PAGE_SIZE;
-        
-        // Step 3: Validate page number
-        if (page >= FRAME_COUNT) {
-            debugPrint("Invalid page: " + to_string(page));
-            cpu.PI = PI_PAGE_FAULT;
-            return false;
-        }
-    
-        // Step 4: Check page table entry
-        if (!currentPCB->pageTable[page].valid) {
-            debugPrint("Page not allocated: " + to_string(page));
-            cpu.PI = PI_PAGE_FAULT;
-            return false;
-        }
-    
-        int frame = currentPCB->pageTable[page].frame;
-        
-        // Step 5: Validate frame number
-        if (frame < 0 || frame >= FRAME_COUNT) {
-            debugPrint("Invalid frame: " + to_string(frame));
-            cpu.PI = PI_PAGE_FAULT;
-            return false;
-        }
-    
-        // Step 6: Calculate real address
-        RA = frame * PAGE_SIZE + offset;
-        
-        // Final validation
-        if (RA < 0 || RA >= MEM_SIZE) {
-            debugPrint("Invalid RA: " + to_string(RA));
-            cpu.PI = PI_OPERAND_ERR;
-            return false;
-        }
-    
-        debugPrint("Successful mapping: VA=" + to_string(VA) + 
-                  " → page=" + to_string(page) + 
-                  " → frame=" + to_string(frame) + 
-                  " → RA=" + to_string(RA));
-        return true;
-    }
+// Which ready process the CPU runs next
+enum SchedulingPolicy {
+    POLICY_RR,        // FIFO with a fixed quantum
+    POLICY_PRIORITY,  // lowest PCB::priority first, round-robin among equals
+    POLICY_SRT,       // least remaining time (TTL - TTC) first
+    POLICY_MLFQ       // multilevel feedback, demoted after a full quantum
+};
 
-    // I/O operations
-    void handleRead() {
-        // Check data availability
-        if (currentPCB->dataCards.empty()) {
-            debugPrint("No more data cards");
-            cpu.SI = TERM;
-            return;
-        }
-    
-        string data = currentPCB->dataCards.front();
-        currentPCB->dataCards.erase(currentPCB->dataCards.begin());
-        debugPrint("Reading data: " + data);
-    
-        // Process data in WORD_SIZE chunks
-        for (size_t i = 0; i < data.length(); i += WORD_SIZE) {
-            string word = data.substr(i, min(static_cast<size_t>(WORD_SIZE), data.length()-i));
-            word.resize(WORD_SIZE, ' '); // Pad with spaces if needed
-    
-            // Calculate target address
-            int targetVA = cpu.RA + (i/WORD_SIZE);
-            int RA;
-            
-            // Map virtual address
-            if (!addressMap(targetVA, RA)) {
-                debugPrint("Address mapping failed for VA: " + to_string(targetVA));
-                return;
-            }
-    
-            // Write to memory
-            for (int j = 0; j < WORD_SIZE; j++) {
-                mem.data[RA][j] = word[j];
-            }
-            debugPrint("Wrote '" + word + "' to RA " + to_string(RA));
-        }
+const char* schedulingName(SchedulingPolicy policy) {
+    switch (policy) {
+        case POLICY_PRIORITY: return "priority";
+        case POLICY_SRT: return "srt";
+        case POLICY_MLFQ: return "mlfq";
+        default: return "rr";
     }
-    
+}
 
-    void handleWrite() {
-    // Check line limit
-    currentPCB->LLC++;
-    if (currentPCB->LLC > currentPCB->TLL) {
-        debugPrint("Line limit exceeded (" + 
-                 to_string(currentPCB->LLC) + "/" + 
-                 to_string(currentPCB->TLL) + ")");
-        cpu.SI = TERM;
-        return;
-    }
+bool parseScheduling(const string& name, SchedulingPolicy& policy) {
+    if (name == "rr") policy = POLICY_RR;
+    else if (name == "priority") policy = POLICY_PRIORITY;
+    else if (name == "srt") policy = POLICY_SRT;
+    else if (name == "mlfq") policy = POLICY_MLFQ;
+    else return false;
+    return true;
+}
 
-    int RA;
-    if (!addressMap(cpu.RA, RA)) {
-        debugPrint("Address mapping failed for write");
-        return;
-    }
+// When a spooled job may enter memory
+enum AdmissionPolicy {
+    ADMIT_FREE_FRAMES,  // its initial frames are free right now
+    ADMIT_WORKING_SET   // its estimated working set fits beside the admitted jobs'
+};
 
-    // Read from memory
-    string output;
-    for (int i = 0; i < WORD_SIZE; i++) {
-        if (mem.data[RA][i] != '\0') {
-            output += mem.data[RA][i];
-        }
-    }
+const char* admissionName(AdmissionPolicy policy) {
+    return policy == ADMIT_WORKING_SET ? "working-set" : "free";
+}
 
-    // Write to output file
-    outFile << output << endl;
-    debugPrint("Wrote to output: " + output);
+bool parseAdmission(const string& name, AdmissionPolicy& policy) {
+    if (name == "free") policy = ADMIT_FREE_FRAMES;
+    else if (name == "working-set") policy = ADMIT_WORKING_SET;
+    else return false;
+    return true;
 }
-    
 
-    // Termination handling
-    void terminate(EM_Code code) {
-        if (!currentPCB) return;
-    
-        // 1. Log termination details
-        debugPrint("Terminating process " + to_string(currentPCB->pid));
-        outFile << "\n\nProcess " << currentPCB->pid << " terminated: ";
-        
-        // Termination reason message
-        switch(code) {
-            case EM_NO_ERR: outFile << "Normal termination"; break;
-            case EM_OUT_OF_DATA: outFile << "Out of data"; break;
-            case EM_LINE_LIMIT: outFile << "Line limit exceeded"; break;
-            case EM_TIME_LIMIT: outFile << "Time limit exceeded"; break;
-            case EM_OP_CODE_ERR: outFile << "Invalid operation code"; break;
-            case EM_OPERAND_ERR: outFile << "Invalid operand"; break;
-            case EM_INVALID_PAGE: outFile << "Invalid page access"; break;
-        }
-        outFile << "\nTTC: " << currentPCB->TTC << ", LLC: " << currentPCB->LLC << endl;
-    
-        // 2. Release all resources systematically
-        
-        // a) Release memory frames (including page table frame)
-        if (currentPCB->PTR != -1) {
-            int pageTableFrame = currentPCB->PTR / PAGE_SIZE;
-            mem.allocated[pageTableFrame] = false;
-            mem.clearFrame(pageTableFrame);
-            mem.unlockFrame(pageTableFrame);
-        }
-    
-        for (int i = 0; i < FRAME_COUNT; i++) {
-            if (currentPCB->pageTable[i].valid) {
-                int frame = currentPCB->pageTable[i].frame;
-                if (frame >= 0 && frame < FRAME_COUNT) {
-                    mem.allocated[frame] = false;
-                    mem.clearFrame(frame);
-                    mem.unlockFrame(frame);
+// Where allocateFrame() places new pages
+enum FramePlacement {
+    PLACE_FIRST_FIT, // lowest free frame
+    PLACE_RANDOM     // random starting point, course-style scattered layout
+};
+
+// Startup configuration for a MOS instance
+struct MOSConfig {
+    MemoryGeometry geometry;
+    FramePlacement placement = PLACE_FIRST_FIT;
+    unsigned seed = 1; // PLACE_RANDOM generator seed
+    bool demandPaging = true; // load pages on first touch instead of up front
+    bool sharePages = false;  // jobs with identical program pages share frames (demand paging)
+    AdmissionPolicy admission = ADMIT_WORKING_SET;
+    int dataPageEstimate = 1; // data pages per job in its working-set estimate
+    ReplacementPolicy replacement = REPLACE_CLOCK;
+    bool pagingReport = false; // add fault counts to each end-of-job report
+    bool backgroundSpooling = true; // read cards on a thread while the CPU runs
+    int spoolCapacity = 64;         // parsed jobs buffered ahead of admission
+    bool mapInput = true;           // mmap an input file instead of reading it
+    int outputBufferBytes = 64 * 1024; // per-job PD buffer before a partial commit
+    bool asyncPrinter = false;         // drain committed output on a writer thread
+    bool deckOrderOutput = false;      // print jobs in deck order, not termination order
+    // Receives each job's output in place of the printer: the whole block at
+    // termination, or a part when the job fills outputBufferBytes. Calls
+    // come one at a time, under the kernel lock, in termination order.
+    // jobId is the job's place in the deck from 0 (PCB::deckSeq); unlike
+    // the $AMJ pid it tells two jobs with the same pid apart.
+    function<void(long long jobId, int pid, const string& text, bool final)> jobOutput;
+    long long timerLimit = MAX_TIMER;  // global ticks before the system halts
+    SchedulingPolicy scheduling = POLICY_RR;
+    int quantum = 10;                  // ticks per slice (MLFQ: at the top level)
+    int mlfqLevels = 3;
+    int cpus = 1;                      // simulated CPUs, one host thread each
+    bool recordJobs = false;           // keep a JobRecord per terminated job
+    bool threadedCore = true;          // run LR/SR/CR/BT stretches in the threaded interpreter
+    bool blockCache = true;            // and translate the hot ones into blocks
+    bool extendedISA = false;          // AD, SB, CL, BU and MV on top of the original seven
+    PerfFormat perfFormat = PERF_OFF;  // also turns on the stage timers
+    string perfPath;                   // empty: perf.json or perf.csv
+    long long perfInterval = 0;        // ticks between interval records, 0 for none
+    int traceRecords = 0;              // per-CPU binary trace ring, 0 for none
+    string tracePath;                  // where dumps go; empty: trace.bin, or none when replaying
+    string replayPath;                 // rerun, or resume restorePath, against the first dump of this trace
+    string checkpointPath;             // where checkpoints go, empty for none
+    long long checkpointInterval = 0;  // ticks between checkpoints, 0: on SIGUSR2 only
+    string restorePath;                // resume from this checkpoint
+    bool asyncIO = false;              // GD/PD block the process instead of the CPU
+    int ioLatency = 0;                 // ticks a channel takes per GD/PD transfer
+};
+
+// A GD or PD handed to a channel. Its target frame stays pinned until the
+// transfer completes at doneTick.
+struct IORequest {
+    PCB* pcb;
+    int op;      // READ or WRITE
+    int RA;      // real address of the transfer
+    long long doneTick;
+};
+
+// One simulated I/O channel, serving its requests in FIFO order
+struct IOChannel {
+    deque<IORequest> pending;
+    long long freeAt = 0;    // tick the last queued transfer completes
+    long long requests = 0;
+    long long busyTicks = 0;
+};
+
+// Performance counters, kept per PCB and folded into MOS-wide totals.
+// The PERF_CYCLES_* stage timers only run with --perf; the rest always count.
+enum PerfCounter {
+    PERF_RETIRED,                               // one per OpCode
+    PERF_TRANSLATIONS = PERF_RETIRED + OP_COUNT,
+    PERF_TLB_MISSES,
+    PERF_PAGE_FAULTS,
+    PERF_INTERRUPTS,                            // one per InterruptBit
+    PERF_DISPATCHES = PERF_INTERRUPTS + IRQ_COUNT,
+    PERF_FRAME_ALLOCATIONS,
+    PERF_CYCLES_FETCH,
+    PERF_CYCLES_DECODE,
+    PERF_CYCLES_EXECUTE,
+    PERF_CYCLES_IO,
+    PERF_COUNT
+};
+
+string perfCounterName(int counter) {
+    static const char* const rest[] = {"translations", "tlb_misses", "page_faults"};
+    static const char* const tail[] = {"dispatches", "frame_allocations", "cycles_fetch", "cycles_decode",
+                                       "cycles_execute", "cycles_io"};
+    if (counter < PERF_TRANSLATIONS) return string("retired_") + opCodeName(counter - PERF_RETIRED);
+    if (counter < PERF_INTERRUPTS) return rest[counter - PERF_TRANSLATIONS];
+    if (counter < PERF_DISPATCHES) return string("interrupts_") + interruptName(counter - PERF_INTERRUPTS);
+    return tail[counter - PERF_DISPATCHES];
+}
+
+struct PerfCounters {
+    long long v[PERF_COUNT] = {};
+};
+
+// Cycle timestamp for the stage timers: the TSC where there is one
+inline unsigned long long cycleCount() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Binary execution trace. Each general-loop instruction is recorded into
+// its CPU's ring without formatting; rings are dumped to the trace file
+// when a job dies of a page fault, operand or opcode error, and on
+// SIGUSR1. The file is a TraceFileHeader and then dumps, each a
+// TraceDumpHeader followed by its records, oldest first.
+struct TraceRecord {
+    int64_t tick;         // globalTimer when the instruction was fetched
+    int32_t pid;
+    int32_t RA;           // real address of the instruction word
+    int16_t IC;           // its virtual address
+    int16_t operand;      // decoded operand, -1 when not a number
+    uint8_t op;           // OpCode
+    uint8_t interrupts;   // InterruptBit mask raised by the instruction
+    uint8_t reserved[2];
+};
+static_assert(sizeof(TraceRecord) == 24, "trace files use a fixed record layout");
+
+const uint32_t TRACE_VERSION = 1;
+
+struct TraceFileHeader {
+    char magic[8];        // "MOSTRACE"
+    uint32_t version;
+    uint32_t recordSize;
+};
+
+enum TraceDumpReason { TRACE_DUMP_FAULT, TRACE_DUMP_REQUEST };
+
+struct TraceDumpHeader {
+    uint32_t cpu;
+    uint32_t reason;      // TraceDumpReason
+    int32_t pid;          // faulting job, -1 on request
+    uint32_t count;       // records that follow
+    uint64_t recorded;    // records written to the ring in total
+};
+
+// Power-of-two ring, written only by its own CPU
+struct TraceRing {
+    vector<TraceRecord> records;
+    uint64_t recorded = 0;
+
+    void init(int capacity) {
+        size_t size = 1;
+        while ((int)size < capacity) size <<= 1;
+        records.assign(size, TraceRecord{});
+        recorded = 0;
+    }
+    bool enabled() const { return !records.empty(); }
+    TraceRecord& next() { return records[recorded++ & (records.size() - 1)]; }
+    size_t size() const { return (size_t)min<uint64_t>(recorded, records.size()); }
+    // i-th oldest record still held
+    const TraceRecord& at(size_t i) const { return records[(recorded - size() + i) & (records.size() - 1)]; }
+};
+
+// Bumped by SIGUSR1; each CPU dumps its ring when it sees a new value
+atomic<int> traceDumpRequests{0};
+
+extern "C" void requestTraceDump(int) { traceDumpRequests++; }
+
+// Read every dump of a trace file; throws on a file this MOS cannot read
+vector<pair<TraceDumpHeader, vector<TraceRecord>>> readTrace(const string& path) {
+    ifstream file(path, ios::binary);
+    if (!file) throw runtime_error("Failed to open trace file: " + path);
+    TraceFileHeader header;
+    if (!file.read((char*)&header, sizeof header) || memcmp(header.magic, "MOSTRACE", 8) != 0) {
+        throw runtime_error("Not a trace file: " + path);
+    }
+    if (header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        throw runtime_error("Unsupported trace version " + to_string(header.version) + ": " + path);
+    }
+    vector<pair<TraceDumpHeader, vector<TraceRecord>>> dumps;
+    TraceDumpHeader dump;
+    while (file.read((char*)&dump, sizeof dump)) {
+        vector<TraceRecord> records(dump.count);
+        if (!file.read((char*)records.data(), dump.count * sizeof(TraceRecord))) {
+            throw runtime_error("Truncated trace file: " + path);
+        }
+        dumps.emplace_back(dump, move(records));
+    }
+    return dumps;
+}
+
+void printTraceRecord(ostream& out, const TraceRecord& r) {
+    out << setw(8) << r.tick << "  pid " << setw(3) << r.pid << "  IC " << setw(2) << r.IC << "  RA "
+        << setw(4) << r.RA << "  " << opCodeName(r.op);
+    if (r.operand >= 0) out << ' ' << r.operand;
+    for (int irq = 0; irq < IRQ_COUNT; irq++) {
+        if (r.interrupts & (1u << irq)) out << "  !" << interruptName(irq);
+    }
+    out << '\n';
+}
+
+// Offline decoder behind --decode-trace
+void decodeTrace(const string& path, ostream& out) {
+    auto dumps = readTrace(path);
+    for (size_t d = 0; d < dumps.size(); d++) {
+        const TraceDumpHeader& h = dumps[d].first;
+        out << "Dump " << d << ": CPU " << h.cpu << ", "
+            << (h.reason == TRACE_DUMP_FAULT ? "fault in pid " + to_string(h.pid) : string("on request")) << ", "
+            << h.count << " of " << h.recorded << " records\n";
+        for (const TraceRecord& r : dumps[d].second) printTraceRecord(out, r);
+    }
+}
+
+// Records two runs agree on; the reserved bytes are not compared
+bool sameTraceRecord(const TraceRecord& a, const TraceRecord& b) {
+    return a.tick == b.tick && a.pid == b.pid && a.RA == b.RA && a.IC == b.IC && a.operand == b.operand &&
+           a.op == b.op && a.interrupts == b.interrupts;
+}
+
+// Turnaround of one job, from admission to termination
+struct JobRecord {
+    int pid;
+    EM_Code code;
+    int TTC;
+    long long admitTick;
+    long long finishTick;
+    double turnaroundMicros;
+};
+
+// Process Context for context switching
+// Saved register file; a switch copies the whole CPUState at once
+struct ProcessContext {
+    CPUState cpu;
+    bool saved = false; // false until the first switch out; the job starts at IC 0
+};
+
+// Scheduling fields of one block of process-table slots, an array per
+// field, so queue keys and accounting read contiguous memory
+struct ProcessFields {
+    static const int SLOTS = 64;
+    ProcessState state[SLOTS];
+    int priority[SLOTS];          // from the $AMJ card, lower runs first
+    int TTC[SLOTS];
+    int TTL[SLOTS];
+};
+
+// A job's program or data cards. Each card is a span, either into the
+// mapped input deck (borrowed) or into an arena the spooler owns and fills
+// once. GD reads data cards through a cursor, so consuming a card is O(1).
+struct CardDeck {
+    struct Span {
+        size_t offset;
+        size_t length;
+    };
+    const char* base = nullptr; // mapped deck, or null for the arena
+    string arena;
+    vector<Span> cards;
+    size_t cursor = 0;          // next card GD reads
+
+    // Borrow later cards from a buffer that outlives the deck
+    void borrow(const char* text) { base = text; }
+
+    void add(const char* text, size_t length) {
+        if (base) {
+            cards.push_back({size_t(text - base), length});
+        } else {
+            cards.push_back({arena.size(), length});
+            arena.append(text, length);
+        }
+    }
+    size_t size() const { return cards.size(); }
+    bool empty() const { return cursor == cards.size(); }
+
+    const char* at(size_t i, size_t& length) const {
+        length = cards[i].length;
+        return (base ? base : arena.data()) + cards[i].offset;
+    }
+
+    // The next card's text, which stays valid until clear()
+    const char* take(size_t& length) { return at(cursor++, length); }
+
+    void clear() {
+        string().swap(arena);
+        vector<Span>().swap(cards);
+        cursor = 0;
+    }
+};
+
+// Enhanced PCB with context information
+struct PCB {
+    int pid;
+    int TLL;
+    int LLC = 0;
+    vector<PageTableEntry> pageTable; // one entry per virtual page
+    int PTR;
+    CardDeck dataCards;
+    string outputBuffer;          // PD lines not yet committed to the printer
+    CardDeck programCards;        // one instruction per card, blank cards dropped
+    int programPages = 0;         // virtual pages 0..programPages-1 hold code
+    int pageFaults = 0;
+    int swapIns = 0;
+    // Admission order, which is deck order. Unlike the $AMJ pid it is
+    // unique, so it also tags the job's TLB entries and translated blocks.
+    long long deckSeq = 0;
+    long long admitTick = 0;
+    chrono::steady_clock::time_point admitTime;
+    bool terminated = false;
+    ProcessContext context;
+    int schedLevel = 0;           // MLFQ queue level
+    long long schedEpoch = 0;     // MLFQ boost the level belongs to
+    int workingSet = 0;           // estimated frames, committed while it is admitted
+    bitset<NUM_INTERRUPTS> interruptMask;
+    PerfCounters perf;            // charged by whichever CPU runs the job
+    PerfCounters perfFolded;      // the part already added to the MOS totals
+    int slot = -1;                // process-table index
+    ProcessFields* fields = nullptr; // the block holding this slot's scheduling fields
+    int lane = 0;                 // this slot's index in fields
+
+    ProcessState& state() { return fields->state[lane]; }
+    ProcessState state() const { return fields->state[lane]; }
+    int& priority() { return fields->priority[lane]; }
+    int priority() const { return fields->priority[lane]; }
+    int& TTC() { return fields->TTC[lane]; }
+    int TTC() const { return fields->TTC[lane]; }
+    int& TTL() { return fields->TTL[lane]; }
+    int TTL() const { return fields->TTL[lane]; }
+
+    // A fresh job in the same slot; the page table keeps its capacity
+    void reset() {
+        PCB fresh{};
+        fresh.slot = slot;
+        fresh.fields = fields;
+        fresh.lane = lane;
+        fresh.pageTable.swap(pageTable);
+        fresh.pageTable.clear();
+        *this = move(fresh);
+        state() = READY;
+        priority() = TTC() = TTL() = 0;
+    }
+};
+
+// Process table. PCBs live in blocks that never move once allocated, so a
+// PCB* or a slot index stays valid while its job lives. A terminated job's
+// slot is reused by a later admission, page table capacity included, so
+// once the table has grown to the jobs in memory, admitting and
+// terminating jobs allocates no PCBs. Run queues hold slot indices.
+class ProcessTable {
+    struct Block {
+        ProcessFields fields;
+        PCB pcbs[ProcessFields::SLOTS];
+    };
+    vector<unique_ptr<Block>> blocks;
+    vector<int> freeSlots;        // last freed is reused first, while still in cache
+
+    const ProcessFields& fieldsOf(int slot) const { return blocks[slot / ProcessFields::SLOTS]->fields; }
+    static int lane(int slot) { return slot % ProcessFields::SLOTS; }
+
+    void grow() {
+        int base = (int)blocks.size() * ProcessFields::SLOTS;
+        blocks.emplace_back(new Block());
+        Block& block = *blocks.back();
+        for (int i = ProcessFields::SLOTS - 1; i >= 0; i--) {
+            block.pcbs[i].slot = base + i;
+            block.pcbs[i].fields = &block.fields;
+            block.pcbs[i].lane = i;
+            freeSlots.push_back(base + i);
+        }
+    }
+
+public:
+    PCB* acquire() {
+        if (freeSlots.empty()) grow();
+        PCB* pcb = at(freeSlots.back());
+        freeSlots.pop_back();
+        pcb->reset();
+        return pcb;
+    }
+    void release(PCB* pcb) { freeSlots.push_back(pcb->slot); }
+
+    PCB* at(int slot) const { return &blocks[slot / ProcessFields::SLOTS]->pcbs[lane(slot)]; }
+    int priority(int slot) const { return fieldsOf(slot).priority[lane(slot)]; }
+    int remaining(int slot) const {
+        const ProcessFields& fields = fieldsOf(slot);
+        return fields.TTL[lane(slot)] - fields.TTC[lane(slot)];
+    }
+    size_t capacity() const { return blocks.size() * ProcessFields::SLOTS; }
+};
+
+// Checkpoint files: a SnapshotHeader, then the machine state in the order
+// MOS::writeCheckpoint() puts it. Only a build with the same version and
+// options can restore one.
+const uint32_t SNAPSHOT_VERSION = 8;
+
+struct SnapshotHeader {
+    char magic[8];        // "MOSSNAP"
+    uint32_t version;
+    int32_t options[14];  // geometry and scheduling, see snapshotOptions()
+};
+
+// Bumped by SIGUSR2; the running CPU takes a checkpoint when it sees a new value
+atomic<int> checkpointRequests{0};
+
+extern "C" void requestCheckpoint(int) { checkpointRequests++; }
+
+struct SnapshotWriter {
+    string buffer;
+
+    template <typename T> void put(const T& value) {
+        static_assert(is_trivially_copyable<T>::value, "snapshots store raw bytes");
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof value);
+    }
+    void putBytes(const void* data, size_t length) {
+        put<uint64_t>(length);
+        buffer.append(static_cast<const char*>(data), length);
+    }
+    void putString(const string& text) { putBytes(text.data(), text.size()); }
+    void putCards(const CardDeck& deck) {
+        put<uint64_t>(deck.size());
+        put<uint64_t>(deck.cursor);
+        for (size_t i = 0; i < deck.size(); i++) {
+            size_t length;
+            const char* text = deck.at(i, length);
+            putBytes(text, length);
+        }
+    }
+};
+
+// Reads a mapped checkpoint in place; throws instead of reading past its end
+struct SnapshotReader {
+    const char* pos;
+    const char* end;
+
+    const char* take(size_t length) {
+        if ((size_t)(end - pos) < length) throw runtime_error("Truncated checkpoint");
+        const char* at = pos;
+        pos += length;
+        return at;
+    }
+    template <typename T> T get() {
+        T value;
+        memcpy(&value, take(sizeof value), sizeof value);
+        return value;
+    }
+    // A length-prefixed block, left in the mapping
+    const char* getBytes(size_t& length) {
+        length = get<uint64_t>();
+        return take(length);
+    }
+    string getString() {
+        size_t length;
+        const char* text = getBytes(length);
+        return string(text, length);
+    }
+    // Restored into the deck's own arena, the input may since have changed
+    void getCards(CardDeck& deck) {
+        size_t count = get<uint64_t>();
+        size_t cursor = get<uint64_t>();
+        deck.clear();
+        for (size_t i = 0; i < count; i++) {
+            size_t length;
+            const char* text = getBytes(length);
+            deck.add(text, length);
+        }
+        deck.cursor = cursor;
+    }
+};
+
+// Ready-queue policy. The MOS pops the next process at every dispatch and
+// pushes the running one back when its quantum runs out. Queues hold
+// process-table slots.
+class Scheduler {
+public:
+    virtual ~Scheduler() {}
+    // expired: the process used its whole quantum rather than just arriving
+    virtual void push(PCB* pcb, bool expired) = 0;
+    virtual PCB* pop(long long now) = 0;
+    virtual bool empty() const = 0;
+    virtual size_t size() const = 0;
+    // Hand a process to another CPU's queue; by default the one pop() gives
+    virtual PCB* steal(long long now) { return pop(now); }
+    virtual int quantum(const PCB*) const { return baseQuantum; }
+    // For checkpoints: the queued processes in pop order, which push()
+    // restores, and any policy state beyond them
+    virtual vector<PCB*> queued() const = 0;
+    virtual vector<long long> state() const { return {}; }
+    virtual void setState(const vector<long long>&) {}
+
+protected:
+    Scheduler(const ProcessTable& table, int q) : procs(table), baseQuantum(q) {}
+    vector<PCB*> pcbs(const deque<int>& slots) const {
+        vector<PCB*> order;
+        for (int slot : slots) order.push_back(procs.at(slot));
+        return order;
+    }
+    const ProcessTable& procs;
+    int baseQuantum;
+};
+
+class RoundRobinScheduler : public Scheduler {
+    deque<int> ready;
+
+public:
+    RoundRobinScheduler(const ProcessTable& table, int q) : Scheduler(table, q) {}
+    void push(PCB* pcb, bool) override { ready.push_back(pcb->slot); }
+    PCB* pop(long long) override {
+        int slot = ready.front();
+        ready.pop_front();
+        return procs.at(slot);
+    }
+    bool empty() const override { return ready.empty(); }
+    size_t size() const override { return ready.size(); }
+    vector<PCB*> queued() const override { return pcbs(ready); }
+    // The newest arrival has the least cache state here
+    PCB* steal(long long) override {
+        int slot = ready.back();
+        ready.pop_back();
+        return procs.at(slot);
+    }
+};
+
+// Runs the smallest key first; equal keys go in the order they were pushed
+class KeyedScheduler : public Scheduler {
+    struct Entry {
+        long long key;
+        long long seq;
+        int slot;
+        bool operator<(const Entry& other) const {
+            return key != other.key ? key > other.key : seq > other.seq;
+        }
+    };
+    priority_queue<Entry> ready;
+    long long pushes = 0;
+
+protected:
+    KeyedScheduler(const ProcessTable& table, int q) : Scheduler(table, q) {}
+    virtual long long key(int slot) const = 0;
+
+public:
+    void push(PCB* pcb, bool) override { ready.push({key(pcb->slot), pushes++, pcb->slot}); }
+    PCB* pop(long long) override {
+        int slot = ready.top().slot;
+        ready.pop();
+        return procs.at(slot);
+    }
+    bool empty() const override { return ready.empty(); }
+    size_t size() const override { return ready.size(); }
+    vector<PCB*> queued() const override {
+        vector<PCB*> order;
+        for (priority_queue<Entry> copy = ready; !copy.empty(); copy.pop()) order.push_back(procs.at(copy.top().slot));
+        return order;
+    }
+};
+
+class PriorityScheduler : public KeyedScheduler {
+public:
+    PriorityScheduler(const ProcessTable& table, int q) : KeyedScheduler(table, q) {}
+protected:
+    long long key(int slot) const override { return procs.priority(slot); }
+};
+
+// Remaining time only changes while a process runs, so the key taken at
+// push time stays valid while it waits
+class ShortestRemainingScheduler : public KeyedScheduler {
+public:
+    ShortestRemainingScheduler(const ProcessTable& table, int q) : KeyedScheduler(table, q) {}
+protected:
+    long long key(int slot) const override { return procs.remaining(slot); }
+};
+
+// New jobs start at level 0. A job that uses its whole quantum drops one
+// level, and each level's quantum is twice the one above. Every
+// boostInterval ticks all jobs go back to level 0, so long jobs don't starve.
+class MLFQScheduler : public Scheduler {
+    vector<deque<int>> levels;
+    long long boostInterval;
+    long long lastBoost = 0;
+    long long epoch = 0;
+
+    void boost(long long now) {
+        epoch++;
+        lastBoost = now;
+        for (size_t level = 1; level < levels.size(); level++) {
+            for (int slot : levels[level]) {
+                PCB* pcb = procs.at(slot);
+                pcb->schedLevel = 0;
+                pcb->schedEpoch = epoch;
+                levels[0].push_back(slot);
+            }
+            levels[level].clear();
+        }
+    }
+
+public:
+    MLFQScheduler(const ProcessTable& table, int q, int levelCount)
+        : Scheduler(table, q), levels(max(levelCount, 1)), boostInterval(50LL * q << levels.size()) {}
+
+    void push(PCB* pcb, bool expired) override {
+        if (pcb->schedEpoch != epoch) {
+            pcb->schedEpoch = epoch;
+            pcb->schedLevel = 0;
+        }
+        if (expired && pcb->schedLevel + 1 < (int)levels.size()) pcb->schedLevel++;
+        levels[pcb->schedLevel].push_back(pcb->slot);
+    }
+
+    PCB* pop(long long now) override {
+        if (now - lastBoost >= boostInterval) boost(now);
+        for (deque<int>& level : levels) {
+            if (level.empty()) continue;
+            int slot = level.front();
+            level.pop_front();
+            return procs.at(slot);
+        }
+        return nullptr;
+    }
+
+    bool empty() const override {
+        for (const deque<int>& level : levels) {
+            if (!level.empty()) return false;
+        }
+        return true;
+    }
+
+    size_t size() const override {
+        size_t total = 0;
+        for (const deque<int>& level : levels) total += level.size();
+        return total;
+    }
+
+    int quantum(const PCB* pcb) const override { return baseQuantum << pcb->schedLevel; }
+
+    // Levels come back from each PCB's schedLevel, epoch permitting
+    vector<PCB*> queued() const override {
+        vector<PCB*> order;
+        for (const deque<int>& level : levels) {
+            vector<PCB*> part = pcbs(level);
+            order.insert(order.end(), part.begin(), part.end());
+        }
+        return order;
+    }
+    vector<long long> state() const override { return {lastBoost, epoch}; }
+    void setState(const vector<long long>& saved) override {
+        if (saved.size() != 2) throw runtime_error("Bad MLFQ checkpoint state");
+        lastBoost = saved[0];
+        epoch = saved[1];
+    }
+};
+
+unique_ptr<Scheduler> makeScheduler(const MOSConfig& config, const ProcessTable& procs) {
+    switch (config.scheduling) {
+        case POLICY_PRIORITY: return unique_ptr<Scheduler>(new PriorityScheduler(procs, config.quantum));
+        case POLICY_SRT: return unique_ptr<Scheduler>(new ShortestRemainingScheduler(procs, config.quantum));
+        case POLICY_MLFQ: return unique_ptr<Scheduler>(new MLFQScheduler(procs, config.quantum, config.mlfqLevels));
+        default: return unique_ptr<Scheduler>(new RoundRobinScheduler(procs, config.quantum));
+    }
+}
+
+// One simulated CPU with its own registers, TLB and run queue. Idle CPUs
+// steal from the longest run queue. Aligned so CPUs on different host
+// threads don't share cache lines.
+struct alignas(CACHE_LINE) Processor {
+    int id = 0;
+    CPUState cpu;
+    PCB* currentPCB = nullptr;
+    unique_ptr<Scheduler> runQueue;
+    int sliceUsed = 0;                    // ticks the running process has had in this quantum
+    long long timerLeft = 0;              // interval timer: ticks until it raises TI
+    long long timerSet = 0;               // timerLeft when last armed or settled
+    int faultPage = -1;                   // page that raised the last PI_PAGE_FAULT
+    AccessType faultAccess = ACCESS_READ; // and the access that touched it
+    int executingFrame = -1;              // frame of the instruction in flight, never a victim
+    bool yieldRequested = false;          // a fault found every frame in use by other CPUs
+    TLB tlb;                              // sits in front of the page-table walk in addressMap()
+    BlockCache blocks;                    // hot loops of the threaded core
+    long long pendingTicks = 0;           // retired here, not yet added to globalTimer
+    long long instructions = 0;
+    long long steals = 0;
+    OpCode executingOp = OP_INVALID;      // of the instruction in flight, for the retired counts
+    TraceRing trace;
+    int traceRequestsSeen = 0;            // traceDumpRequests at this CPU's last dump
+};
+
+// Logging levels, each includes the ones below it
+enum LogLevel { LOG_OFF = 0, LOG_ERROR = 1, LOG_INFO = 2, LOG_TRACE = 3 };
+
+// Compile-time ceiling; build with -DMOS_LOG_LEVEL=0 to strip every log call
+#ifndef MOS_LOG_LEVEL
+#define MOS_LOG_LEVEL LOG_TRACE
+#endif
+constexpr int COMPILED_LOG_LEVEL = MOS_LOG_LEVEL;
+
+// Runtime level for builds that keep logging compiled in
+int runtimeLogLevel = LOG_TRACE;
+
+void debugPrint(int level, const string& msg) {
+    static const char* const tags[] = {"", "[ERROR] ", "[INFO] ", "[DEBUG] "};
+    cout << tags[level] << msg << '\n';
+}
+
+// The message expression is only evaluated when its level is enabled, and
+// compiled out entirely above COMPILED_LOG_LEVEL
+#define MOS_LOG(level, msg)                                        \
+    do {                                                           \
+        if constexpr ((level) <= COMPILED_LOG_LEVEL) {             \
+            if ((level) <= runtimeLogLevel) debugPrint((level), (msg)); \
+        }                                                          \
+    } while (0)
+
+bool parseLogLevel(const string& name, int& level) {
+    if (name == "off") level = LOG_OFF;
+    else if (name == "error") level = LOG_ERROR;
+    else if (name == "info") level = LOG_INFO;
+    else if (name == "trace") level = LOG_TRACE;
+    else return false;
+    return true;
+}
+
+// A job as read off the card deck, before it is given any memory
+struct JobCard {
+    int pid = 0;
+    int TTL = 0;
+    int TLL = 0;
+    int priority = 0;
+    CardDeck programCards;
+    CardDeck dataCards;
+    size_t deckStart = 0;  // byte offsets of its $AMJ card and past its $END
+    size_t deckEnd = 0;
+};
+
+// Read-only mapping of a whole input deck, or a caller's buffer standing
+// in for one. data() is null when the file is empty or cannot be mapped;
+// the deck is then read as a stream.
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+        if (base && owned) munmap(base, length);
+    }
+
+    bool open(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                base = map;
+                length = st.st_size;
+                owned = true;
+                madvise(base, length, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+        return base != nullptr;
+    }
+
+    // Scan memory the caller owns; it is never unmapped
+    void borrow(const char* data, size_t size) {
+        base = const_cast<char*>(data);
+        length = size;
+        owned = false;
+    }
+
+    const char* data() const { return static_cast<const char*>(base); }
+    size_t size() const { return length; }
+
+private:
+    void* base = nullptr;
+    size_t length = 0;
+    bool owned = false;
+};
+
+// Input spooling (channel 1): parses $AMJ/$DTA/$END cards one job at a
+// time. In background mode a reader thread runs ahead of the CPU into a
+// bounded buffer, so memory use depends on the buffer size, not the deck.
+class InputSpooler {
+public:
+    // A non-null mapped deck is scanned in place and the jobs' cards point
+    // into it; otherwise cards are read from input and copied
+    // reading from byte offset start, which a checkpoint gives
+    InputSpooler(istream& input, const MappedFile* mapped, bool background, size_t capacity, size_t start = 0)
+        : in(input), background(background), capacity(max<size_t>(capacity, 1)), consumed(start) {
+        if (mapped && mapped->data()) {
+            begin = mapped->data();
+            end = begin + mapped->size();
+            pos = begin + min(start, mapped->size());
+        } else if (start) {
+            in.clear();
+            in.seekg(start);
+        }
+        if (background) {
+            reader = thread(&InputSpooler::readerLoop, this);
+        }
+    }
+
+    ~InputSpooler() {
+        {
+            lock_guard<mutex> lk(lock);
+            stopping = true;
+        }
+        spaceFree.notify_all();
+        if (reader.joinable()) reader.join();
+    }
+
+    // Hand over the next job in deck order, blocking until the reader has
+    // parsed it; returns false once the deck is exhausted. The reader is
+    // normally well ahead, and always waiting keeps admission deterministic.
+    bool next(JobCard& job) {
+        if (!background) {
+            if (done) return false;
+            if (parseJob(job)) return true;
+            done = true;
+            return false;
+        }
+
+        unique_lock<mutex> lk(lock);
+        jobReady.wait(lk, [this] { return !buffer.empty() || done; });
+        if (buffer.empty()) {
+            if (done && error) rethrow_exception(error);
+            return false;
+        }
+        job = move(buffer.front());
+        buffer.pop_front();
+        lk.unlock();
+        spaceFree.notify_one();
+        return true;
+    }
+
+private:
+    // Next card of the deck, without its newline, like getline
+    bool nextLine(const char*& text, size_t& length) {
+        lineStart = consumed;
+        if (!end) {
+            if (!getline(in, line)) return false;
+            text = line.data();
+            length = line.size();
+            consumed += length + (in.eof() ? 0 : 1);
+            return true;
+        }
+        if (pos == end) return false;
+        const char* newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        text = pos;
+        length = (newline ? newline : end) - pos;
+        pos = newline ? newline + 1 : end;
+        consumed = pos - begin;
+        return true;
+    }
+
+    static bool isControl(const char* text, size_t length, const char* card) {
+        return length >= 4 && text[0] == '$' && memcmp(text, card, 4) == 0;
+    }
+
+    // Read cards up to and including the next job's $END
+    bool parseJob(JobCard& job) {
+        const char* text;
+        size_t length;
+        bool inJob = false;
+        bool readingData = false;
+
+        while (nextLine(text, length)) {
+            MOS_LOG(LOG_TRACE, "Read line: " + string(text, length));
+
+            if (isControl(text, length, "$AMJ")) {
+                MOS_LOG(LOG_INFO, "Found new job");
+                string card(text, length);
+                job = JobCard();
+                job.deckStart = lineStart;
+                job.pid = stoi(card.substr(4, 4));
+                job.TTL = stoi(card.substr(8, 4));
+                job.TLL = stoi(card.substr(12, 4));
+                // Optional priority digits after the TLL field
+                size_t end = 16;
+                while (end < card.size() && end < 18 && isdigit(static_cast<unsigned char>(card[end]))) end++;
+                if (end > 16) job.priority = stoi(card.substr(16, end - 16));
+                if (this->end) {
+                    job.programCards.borrow(text);
+                    job.dataCards.borrow(text);
+                }
+                inJob = true;
+                readingData = false;
+            }
+            else if (!inJob) {
+                continue;
+            }
+            else if (isControl(text, length, "$DTA")) {
+                MOS_LOG(LOG_TRACE, "Found data section");
+                readingData = true;
+            }
+            else if (isControl(text, length, "$END")) {
+                MOS_LOG(LOG_INFO, "End of job " + to_string(job.pid));
+                job.deckEnd = consumed;
+                return true;
+            }
+            else if (readingData) {
+                job.dataCards.add(text, length);
+                MOS_LOG(LOG_TRACE, "Added data card: " + string(text, length));
+            }
+            else if (any_of(text, text + length, [](char c) { return !isspace(static_cast<unsigned char>(c)); })) {
+                job.programCards.add(text, length);
+            }
+        }
+        return false;
+    }
+
+    void readerLoop() {
+        try {
+            JobCard job;
+            while (parseJob(job)) {
+                unique_lock<mutex> lk(lock);
+                spaceFree.wait(lk, [this] { return buffer.size() < capacity || stopping; });
+                if (stopping) return;
+                buffer.push_back(move(job));
+                lk.unlock();
+                jobReady.notify_one();
+            }
+        } catch (...) {
+            lock_guard<mutex> lk(lock);
+            error = current_exception();
+        }
+        {
+            lock_guard<mutex> lk(lock);
+            done = true;
+        }
+        jobReady.notify_all();
+    }
+
+    istream& in;
+    string line;               // stream mode: the card being parsed
+    const char* begin = nullptr; // mapped mode: the deck
+    const char* pos = nullptr;   // and its unread part
+    const char* end = nullptr;
+    bool background;
+    size_t capacity;
+    size_t consumed = 0;         // bytes of the deck read so far
+    size_t lineStart = 0;        // offset of the card last read
+    mutex lock;
+    condition_variable jobReady;
+    condition_variable spaceFree;
+    deque<JobCard> buffer;
+    bool done = false;
+    bool stopping = false;
+    exception_ptr error;
+    thread reader;
+};
+
+class MOS {
+private:
+    MOSConfig config;
+    Memory mem;
+    mt19937 frameRng; // PLACE_RANDOM only, seeded once from config.seed
+
+    // Simulated CPUs; core is the one the calling host thread drives.
+    // Kernel paths (interrupts, faults, scheduling, admission) run under
+    // kernelLock, user-mode instructions run without it.
+    vector<Processor> processors;
+    static thread_local Processor* core;
+    mutex kernelLock;
+    condition_variable workAvailable; // a run queue got a process, or the system stopped
+
+    // Reverse map from frame to the page it holds, for page replacement
+    struct FrameOwner {
+        PCB* pcb = nullptr; // null for free and page-table frames
+        int page = -1;
+        long long loadSeq = 0; // FIFO order
+    };
+    vector<FrameOwner> frameOwners;
+    // VA → page and offset, so the threaded core does no division
+    int vaPage[VIRTUAL_MEM_SIZE];
+    int vaOffset[VIRTUAL_MEM_SIZE];
+    long long frameLoadSeq = 0;
+    int clockHand = 0;
+    SwapStore swap;
+    // Resident program pages open to sharing, by content hash, and every
+    // mapping of each such frame (its FrameOwner is one of them)
+    struct SharedFrame {
+        uint64_t hash;
+        vector<pair<PCB*, int>> mappings;
+    };
+    unordered_map<uint64_t, int> sharedPages;
+    unordered_map<int, SharedFrame> sharedFrames;
+    string pageImage; // scratch for the page being looked up
+
+public:
+    struct PagingStats {
+        long long faults = 0;
+        long long evictions = 0;
+        long long swapOuts = 0;
+        long long swapIns = 0;
+        long long sharedMappings = 0; // program pages mapped onto another job's frame
+        long long cowCopies = 0;      // shared pages copied on their first write
+        long long peakFrames = 0;     // most frames in use at once
+    };
+
+    // Ticks from admission to termination, summed over terminated jobs;
+    // waiting is the part spent ready but not running
+    struct SchedulingStats {
+        long long jobs = 0;        // terminated jobs, the ones the averages cover
+        long long turnaround = 0;
+        long long waiting = 0;
+        long long rejected = 0;    // reported as too big for memory, never admitted
+    };
+
+private:
+    PagingStats pagingStats;
+    SchedulingStats schedulingStats;
+    PerfCounters perfTotals;  // folded from the PCBs under the kernel lock
+    ofstream perfFile;
+    bool perfTiming = false;
+    long long perfRecords = 0;
+    long long nextPerfDump = 0;
+    unsigned long long perfStartCycles = 0;
+    ofstream traceFile;
+    bool tracePinned = false;              // a dump has pinned the checkpoint before it
+    vector<TraceRecord> replayRecords;     // dump of --replay-trace being followed
+    size_t replayMatched = 0;              // how far this run has reproduced it
+    bool replayDiverged = false;
+    long long nextCheckpoint = 0;
+    int checkpointRequestsSeen = 0;
+    size_t deckResume = 0;             // input offset past the last job spooled
+    string outputPath;                 // empty for a caller's stream
+    ifstream inFile;   // only opened by the file-name constructor
+    MappedFile inputMap; // the same file mapped, when config.mapInput allows
+    ofstream outFile;
+    istringstream noInput; // stands in for a stream when the deck is a buffer
+    istream& input;    // inFile or a caller's stream
+    ostream& output;
+    unique_ptr<InputSpooler> spooler; // reads input, so declared after it
+    ProcessTable procs;               // every admitted job's PCB
+    JobCard pendingJob;               // spooled job waiting for frames
+    bool hasPendingJob = false;
+    int committedFrames = 0;          // working sets of the admitted jobs
+    atomic<long long> globalTimer{0};
+    vector<JobRecord> jobRecords;
+    atomic<bool> systemRunning{true};
+    bool interruptsEnabled = true;
+
+    // Interrupt vector table, indexed by InterruptBit
+    using InterruptHandler = void (MOS::*)();
+    static const InterruptHandler interruptVectorTable[IRQ_COUNT];
+    
+    // Hardware ISR state
+    struct HardwareISR {
+        bool printerReady = false;
+        IOChannel diskChannel;    // GD: data cards spooled on disk
+        IOChannel printerChannel; // PD: lines to the job's output
+        queue<string> printerBuffer;
+    } hardwareISR;
+
+    // Critical section lock, guards the printer buffer shared with printerThread
+    mutex criticalSectionLock;
+
+    // Output spooling: a job's output reaches the printer in one piece. Only
+    // outputOwner may commit partial output early; jobs that finish while it
+    // is mid-stream park their blocks in heldOutput until it terminates.
+    PCB* outputOwner = nullptr;
+    deque<string> heldOutput;
+    // Deck-order mode: finished jobs waiting for every earlier job to print
+    map<long long, string> finishedOutput;
+    long long nextDeckSeq = 0;
+    long long admittedJobs = 0;
+    thread printerThread;
+    condition_variable printerWake;
+    bool printerStop = false;
+
+    // Hardware ISR handlers
+    // Channel interrupt: finish every transfer due by now and put its
+    // process back on a run queue. Channels are only touched under the
+    // kernel lock.
+    void handleChannelInterrupt(IOChannel& channel) {
+        while (!channel.pending.empty() && channel.pending.front().doneTick <= globalTimer) {
+            IORequest request = channel.pending.front();
+            channel.pending.pop_front();
+            mem.unlockFrame(request.RA / mem.pageSize);
+            if (request.op == READ) readCard(request.pcb, request.RA);
+            else printLine(request.pcb, request.RA);
+
+            MOS_LOG(LOG_TRACE, "I/O complete for process " + to_string(request.pcb->pid));
+            request.pcb->state() = READY;
+            leastLoadedCPU().runQueue->push(request.pcb, false);
+            workAvailable.notify_one();
+        }
+    }
+
+    void serviceChannels() {
+        handleChannelInterrupt(hardwareISR.diskChannel);
+        handleChannelInterrupt(hardwareISR.printerChannel);
+    }
+
+    bool channelsBusy() const {
+        return !hardwareISR.diskChannel.pending.empty() || !hardwareISR.printerChannel.pending.empty();
+    }
+
+    // Tick of the next transfer completion, the only event that is not
+    // tied to a running process; max() when no transfer is in flight
+    long long nextCompletion() const {
+        long long next = numeric_limits<long long>::max();
+        for (const IOChannel* channel : {&hardwareISR.diskChannel, &hardwareISR.printerChannel}) {
+            if (!channel->pending.empty()) next = min(next, channel->pending.front().doneTick);
+        }
+        return next;
+    }
+
+    // Nothing can run until a transfer finishes: the timer jumps to the
+    // next completion. False when no transfer is in flight.
+    bool idleUntilTransfer() {
+        long long next = nextCompletion();
+        if (next == numeric_limits<long long>::max()) return false;
+        if (next > globalTimer) globalTimer = next;
+        serviceChannels();
+        return true;
+    }
+
+    // Printer channel: write every committed batch queued so far
+    void handlePrinterInterrupt() {
+        queue<string> batches;
+        {
+            lock_guard<mutex> lock(criticalSectionLock);
+            batches.swap(hardwareISR.printerBuffer);
+        }
+        while (!batches.empty()) {
+            const string& data = batches.front();
+            output.write(data.data(), data.size());
+            MOS_LOG(LOG_TRACE, "Printed " + to_string(data.size()) + " bytes");
+            batches.pop();
+        }
+        lock_guard<mutex> lock(criticalSectionLock);
+        hardwareISR.printerReady = hardwareISR.printerBuffer.empty();
+    }
+
+    void printerLoop() {
+        unique_lock<mutex> lock(criticalSectionLock);
+        while (true) {
+            printerWake.wait(lock, [this] { return !hardwareISR.printerBuffer.empty() || printerStop; });
+            if (hardwareISR.printerBuffer.empty()) break;
+            lock.unlock();
+            handlePrinterInterrupt();
+            lock.lock();
+        }
+    }
+
+    // Queue a batch for the printer; synchronous mode prints it right away
+    void sendToPrinter(string&& batch) {
+        if (batch.empty()) return;
+        {
+            lock_guard<mutex> lock(criticalSectionLock);
+            hardwareISR.printerBuffer.push(move(batch));
+            hardwareISR.printerReady = false;
+        }
+        if (printerThread.joinable()) {
+            printerWake.notify_one();
+        } else {
+            handlePrinterInterrupt();
+        }
+    }
+
+    // Hand a job's buffered output to the printer. Partial commits keep the
+    // job's output contiguous by claiming the printer until it terminates.
+    void commitOutput(PCB* pcb, bool final) {
+        if (config.jobOutput) {
+            // Each block names its job, so the caller does the ordering
+            config.jobOutput(pcb->deckSeq, pcb->pid, pcb->outputBuffer, final);
+            pcb->outputBuffer.clear();
+            return;
+        }
+        if (config.deckOrderOutput) {
+            commitInDeckOrder(pcb, final);
+            return;
+        }
+        if (outputOwner && outputOwner != pcb) {
+            if (final) {
+                heldOutput.push_back(move(pcb->outputBuffer));
+                pcb->outputBuffer.clear();
+            }
+            return;
+        }
+
+        sendToPrinter(move(pcb->outputBuffer));
+        pcb->outputBuffer.clear();
+        if (!final) {
+            outputOwner = pcb;
+            return;
+        }
+
+        outputOwner = nullptr;
+        while (!heldOutput.empty()) {
+            sendToPrinter(move(heldOutput.front()));
+            heldOutput.pop_front();
+        }
+    }
+
+    // Deck order: a job prints once every job admitted before it has printed.
+    // Only the oldest unprinted job may commit early, the others keep
+    // buffering.
+    void commitInDeckOrder(PCB* pcb, bool final) {
+        if (pcb->deckSeq != nextDeckSeq) {
+            if (final) {
+                finishedOutput[pcb->deckSeq] = move(pcb->outputBuffer);
+                pcb->outputBuffer.clear();
+            }
+            return;
+        }
+
+        sendToPrinter(move(pcb->outputBuffer));
+        pcb->outputBuffer.clear();
+        if (!final) return;
+
+        nextDeckSeq++;
+        for (auto it = finishedOutput.begin(); it != finishedOutput.end() && it->first == nextDeckSeq;
+             it = finishedOutput.erase(it)) {
+            sendToPrinter(move(it->second));
+            nextDeckSeq++;
+        }
+    }
+
+    void startPrinter() {
+        if (config.asyncPrinter && !printerThread.joinable()) {
+            printerStop = false;
+            printerThread = thread(&MOS::printerLoop, this);
+        }
+    }
+
+    // Drain everything still queued and flush the output file
+    void stopPrinter() {
+        if (printerThread.joinable()) {
+            {
+                lock_guard<mutex> lock(criticalSectionLock);
+                printerStop = true;
+            }
+            printerWake.notify_one();
+            printerThread.join();
+        }
+        handlePrinterInterrupt();
+        output.flush();
+    }
+
+    // Count the ticks since the interval timer was armed into the slice
+    void settleTimer() {
+        core->sliceUsed += int(core->timerSet - core->timerLeft);
+        core->timerSet = core->timerLeft;
+    }
+
+    // Arm this CPU's interval timer for the running process's next event:
+    // the end of its slice, its time limit or, with asynchronous I/O, the
+    // next transfer completion. Instructions only count the timer down;
+    // everything else waits for TI.
+    void armTimer() {
+        settleTimer();
+        PCB* pcb = core->currentPCB;
+        long long left = min<long long>(core->runQueue->quantum(pcb) - core->sliceUsed, pcb->TTL() - pcb->TTC());
+        long long completion = nextCompletion();
+        if (completion != numeric_limits<long long>::max()) left = min(left, max(1LL, completion - now()));
+        core->timerLeft = core->timerSet = left;
+    }
+
+    // Interrupt handlers
+    // Interval timer. Completed transfers were already serviced on the way
+    // into the kernel. The slice is checked before the time limit, so a
+    // job preempted at its limit is ended when it next runs.
+    void handleTimerInterrupt() {
+        core->cpu.TI = 0; // not saved with the context if the job is preempted
+        settleTimer();
+        PCB* pcb = core->currentPCB;
+        if (core->sliceUsed >= core->runQueue->quantum(pcb)) {
+            // Pick up newly spooled jobs before choosing who runs next
+            admitJobs();
+            core->sliceUsed = 0;
+            if (!core->runQueue->empty()) {
+                MOS_LOG(LOG_INFO, "Time slice expired, switching process");
+                preempt(true);
+                return;
+            }
+        }
+        if (pcb->TTC() >= pcb->TTL()) {
+            MOS_LOG(LOG_ERROR, "Time limit exceeded");
+            terminate(EM_TIME_LIMIT);
+            return;
+        }
+        armTimer();
+    }
+
+    void handleOpCodeError() {
+        MOS_LOG(LOG_ERROR, "Operation code error");
+        if (core->trace.enabled()) dumpTrace(TRACE_DUMP_FAULT, core->currentPCB->pid);
+        terminate(EM_OP_CODE_ERR);
+    }
+
+    void handleOperandError() {
+        MOS_LOG(LOG_ERROR, "Operand error");
+        if (core->trace.enabled()) dumpTrace(TRACE_DUMP_FAULT, core->currentPCB->pid);
+        terminate(EM_OPERAND_ERR);
+    }
+
+    void handlePageFault() {
+        if (servicePageFault()) {
+            return;
+        }
+        MOS_LOG(LOG_ERROR, "Page fault");
+        if (core->trace.enabled()) dumpTrace(TRACE_DUMP_FAULT, core->currentPCB->pid);
+        terminate(EM_INVALID_PAGE);
+    }
+
+    // A GD/SR to an unmapped data page gets a fresh frame, and pages evicted
+    // to the drum come back on any access. With demand paging, program
+    // pages also load from the job's card image on first touch. Everything
+    // else (LR/CR/PD/BT on a page never written) stays invalid.
+    bool servicePageFault() {
+        int page = core->faultPage;
+        if (page < 0 || page >= (int)core->currentPCB->pageTable.size()) return false;
+
+        PageTableEntry& pte = core->currentPCB->pageTable[page];
+        if (pte.valid && pte.shared) return copyOnWrite(page);
+        bool programPage = page < core->currentPCB->programPages;
+        bool onDrum = pte.swapSlot >= 0;
+        if (!onDrum) {
+            if (programPage && !config.demandPaging) return false;
+            if (!programPage && core->faultAccess != ACCESS_WRITE) return false;
+        }
+        if (!onDrum && programPage && shareProgramPage(core->currentPCB, page)) {
+            core->currentPCB->pageFaults++;
+            core->currentPCB->perf.v[PERF_PAGE_FAULTS]++;
+            pagingStats.faults++;
+            MOS_LOG(LOG_TRACE, "Page fault serviced: page " + to_string(page) + " shared with frame " +
+                    to_string(pte.frame));
+            restartFaultedInstruction();
+            return true;
+        }
+
+        int frame = allocateFrame();
+        if (frame == -1 && (otherCPUsRunning() || channelsBusy())) {
+            // Every candidate belongs to a process running elsewhere or is
+            // pinned for I/O; give up the CPU and retry the instruction once
+            // some of them are released
+            MOS_LOG(LOG_TRACE, "All frames busy on other CPUs, yielding");
+            restartFaultedInstruction();
+            core->yieldRequested = true;
+            return true;
+        }
+        if (frame == -1) {
+            MOS_LOG(LOG_ERROR, "No free frame for page " + to_string(page));
+            return false;
+        }
+        if (onDrum) {
+            mem.loadFrame(frame, swap.slotData(pte.swapSlot));
+            core->currentPCB->swapIns++;
+            pagingStats.swapIns++;
+        } else if (programPage) {
+            loadProgramPage(core->currentPCB, page, frame);
+        }
+        mapPage(core->currentPCB, page, frame);
+        if (!onDrum && programPage) offerProgramPage(core->currentPCB, page, frame);
+        core->currentPCB->pageFaults++;
+        core->currentPCB->perf.v[PERF_PAGE_FAULTS]++;
+        pagingStats.faults++;
+        MOS_LOG(LOG_TRACE, "Page fault serviced: page " + to_string(page) + " → frame " + to_string(frame));
+
+        restartFaultedInstruction();
+        return true;
+    }
+
+    // FNV-1a over one page of words
+    uint64_t hashPage(const char* words) const {
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < size_t(mem.pageSize) * WORD_SIZE; i++) {
+            hash = (hash ^ (unsigned char)words[i]) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // Map pcb's program page onto a resident frame that already holds the
+    // same words, if there is one. Nothing is allocated or copied.
+    bool shareProgramPage(PCB* pcb, int page) {
+        if (!config.sharePages) return false;
+        pageImage.assign(size_t(mem.pageSize) * WORD_SIZE, '\0');
+        int startInstr = page * mem.pageSize;
+        int endInstr = min(startInstr + mem.pageSize, (int)pcb->programCards.size());
+        for (int j = startInstr; j < endInstr; j++) programWord(pcb, j, &pageImage[(j - startInstr) * WORD_SIZE]);
+
+        auto found = sharedPages.find(hashPage(pageImage.data()));
+        if (found == sharedPages.end()) return false;
+        int frame = found->second;
+        if (memcmp(mem.data[frame * mem.pageSize], pageImage.data(), pageImage.size()) != 0) return false;
+
+        mem.share(frame);
+        sharedFrames.at(frame).mappings.push_back({pcb, page});
+        PageTableEntry& pte = pcb->pageTable[page];
+        pte.frame = frame;
+        pte.valid = true;
+        pte.referenced = true;
+        pte.dirty = false;
+        pte.shared = true;
+        pte.lastUsed = now();
+        pagingStats.sharedMappings++;
+        return true;
+    }
+
+    // A freshly loaded program page becomes shareable until its first write
+    void offerProgramPage(PCB* pcb, int page, int frame) {
+        if (!config.sharePages) return;
+        uint64_t hash = hashPage(mem.data[frame * mem.pageSize]);
+        if (!sharedPages.emplace(hash, frame).second) return; // a different page with the same hash
+        sharedFrames[frame] = SharedFrame{hash, {{pcb, page}}};
+        pcb->pageTable[page].shared = true;
+    }
+
+    // Stop sharing a frame: nothing new maps it from now on
+    void withdrawShared(int frame) {
+        auto shared = sharedFrames.find(frame);
+        for (const auto& mapping : shared->second.mappings) mapping.first->pageTable[mapping.second].shared = false;
+        sharedPages.erase(shared->second.hash);
+        sharedFrames.erase(shared);
+    }
+
+    // Drop pcb's mapping of a shared frame; true when it was the last one
+    // and the frame can be released
+    bool unmapShared(PCB* pcb, int page, int frame) {
+        vector<pair<PCB*, int>>& mappings = sharedFrames.at(frame).mappings;
+        mappings.erase(find(mappings.begin(), mappings.end(), make_pair(pcb, page)));
+        pcb->pageTable[page].shared = false;
+        if (mem.unshare(frame) == 0) {
+            withdrawShared(frame);
+            return true;
+        }
+        FrameOwner& owner = frameOwners[frame];
+        if (owner.pcb == pcb && owner.page == page) {
+            owner.pcb = mappings.front().first;
+            owner.page = mappings.front().second;
+        }
+        return false;
+    }
+
+    // First write to a shared page. The job copies it to a frame of its
+    // own, or keeps the frame when no other job maps it any more.
+    bool copyOnWrite(int page) {
+        PCB* pcb = core->currentPCB;
+        PageTableEntry& pte = pcb->pageTable[page];
+        int shared = pte.frame;
+        if (mem.refCount[shared] == 1) {
+            withdrawShared(shared);
+        } else {
+            // Not a victim while it is copied from
+            mem.lockFrame(shared);
+            int frame = allocateFrame();
+            mem.unlockFrame(shared);
+            if (frame == -1 && (otherCPUsRunning() || channelsBusy())) {
+                MOS_LOG(LOG_TRACE, "All frames busy on other CPUs, yielding");
+                restartFaultedInstruction();
+                core->yieldRequested = true;
+                return true;
+            }
+            if (frame == -1) {
+                MOS_LOG(LOG_ERROR, "No free frame to copy page " + to_string(page));
+                return false;
+            }
+            unmapShared(pcb, page, shared);
+            mem.loadFrame(frame, mem.data[shared * mem.pageSize]);
+            mapPage(pcb, page, frame);
+            pagingStats.cowCopies++;
+            MOS_LOG(LOG_TRACE, "Copied shared page " + to_string(page) + " to frame " + to_string(frame));
+        }
+        core->tlb.invalidate(pcb->deckSeq, page);
+        restartFaultedInstruction();
+        return true;
+    }
+
+    // An operand fault re-executes the instruction, charged only once so
+    // TTC does not depend on memory pressure; a fetch fault simply retries
+    // the fetch, IC has not moved yet. The slice gets its tick back too, or
+    // with a quantum of 1 the job would be preempted before the retry and
+    // lose its page again.
+    void restartFaultedInstruction() {
+        if (core->faultAccess != ACCESS_FETCH) {
+            core->cpu.IC--;
+            core->currentPCB->TTC()--;
+            core->timerLeft++;
+            core->currentPCB->perf.v[PERF_RETIRED + core->executingOp]--;
+        }
+        core->faultPage = -1;
+    }
+
+    bool otherCPUsRunning() const {
+        for (const Processor& p : processors) {
+            if (&p != core && p.currentPCB) return true;
+        }
+        return false;
+    }
+
+    void handleTerminate() {
+        MOS_LOG(LOG_INFO, "Terminate system call");
+        terminate(EM_NO_ERR);
+    }
+
+    
+
+    void saveContext() {
+        if (core->currentPCB) {
+            core->currentPCB->state() = READY;
+            memcpy(&core->currentPCB->context.cpu, &core->cpu, sizeof(CPUState));
+            core->currentPCB->context.saved = true;
+        }
+    }
+
+    void restoreContext() {
+        if (core->currentPCB) {
+            core->currentPCB->state() = RUNNING;
+            if (core->currentPCB->context.saved) {
+                memcpy(&core->cpu, &core->currentPCB->context.cpu, sizeof(CPUState));
+                MOS_LOG(LOG_TRACE, "Restored context: IC = " + to_string(core->cpu.IC));
+            } else {
+                MOS_LOG(LOG_TRACE, "First-time execution: setting IC to 0");
+                core->cpu = CPUState();
+            }
+        }
+    }
+
+    // Pending interrupts of the running process as an InterruptBit mask
+    unsigned pendingInterrupts() const {
+        const CPUState& cpu = core->cpu;
+        unsigned pending = 0;
+        if (cpu.TI) pending |= 1u << IRQ_TIMER;
+        if (cpu.PI >= PI_OP_ERR && cpu.PI <= PI_PAGE_FAULT) pending |= 1u << (IRQ_PI_OP_ERR + cpu.PI - PI_OP_ERR);
+        if (cpu.SI >= READ && cpu.SI <= TERM) pending |= 1u << (IRQ_SI_READ + cpu.SI - READ);
+        return pending;
+    }
+
+    // Dispatch the highest-priority pending interrupt the process has not
+    // masked, then clear the flag it came from. Masked interrupts are
+    // dropped so the CPU does not trap on them again. Handlers run on the
+    // current process's state (a serviced fault rewinds IC); switches to
+    // another process save and restore context themselves.
+    void handleInterrupt() {
+        if (!interruptsEnabled) return;
+
+        unsigned pending = pendingInterrupts();
+        // The timer enforces time limits and slices, so it cannot be masked
+        unsigned masked = pending & (unsigned)core->currentPCB->interruptMask.to_ulong() & ~(1u << IRQ_TIMER);
+        if (masked) {
+            clearInterrupts(masked);
+            pending &= ~masked;
+        }
+        if (!pending) return;
+
+        int irq = 31 - __builtin_clz(pending);
+        core->currentPCB->perf.v[PERF_INTERRUPTS + irq]++;
+        bool io = irq == IRQ_SI_READ || irq == IRQ_SI_WRITE;
+        unsigned long long started = perfTiming && io ? cycleCount() : 0;
+        PCB* pcb = core->currentPCB;
+        (this->*interruptVectorTable[irq])();
+        // The handler may have terminated the job
+        if (started && pcb == core->currentPCB) pcb->perf.v[PERF_CYCLES_IO] += cycleCount() - started;
+        clearInterrupts(1u << irq);
+    }
+
+    void clearInterrupts(unsigned bits) {
+        CPUState& cpu = core->cpu;
+        if (bits & (1u << IRQ_TIMER)) cpu.TI = 0;
+        if (bits & (7u << IRQ_PI_OP_ERR)) cpu.PI = 0;
+        if (bits & (7u << IRQ_SI_READ)) cpu.SI = 0;
+    }
+
+    // Memory management
+    int allocateFrame() {
+        if (mem.freeFrames == 0) {
+            return config.replacement == REPLACE_NONE ? -1 : evictFrame();
+        }
+
+        int start = 0;
+        if (config.placement == PLACE_RANDOM) {
+            start = uniform_int_distribution<>(0, mem.frameCount - 1)(frameRng);
+        }
+        int frame = mem.findFreeFrame(start);
+        if (frame != -1) {
+            mem.claimFrame(frame);
+            pagingStats.peakFrames = max<long long>(pagingStats.peakFrames, mem.frameCount - mem.freeFrames);
+        }
+        return frame;
+    }
+
+    // Make a frame resident for pcb's virtual page
+    void mapPage(PCB* pcb, int page, int frame) {
+        PageTableEntry& pte = pcb->pageTable[page];
+        pte.frame = frame;
+        pte.valid = true;
+        pte.referenced = true;
+        pte.dirty = false;
+        pte.shared = false;
+        pte.lastUsed = now();
+        frameOwners[frame] = FrameOwner{pcb, page, ++frameLoadSeq};
+        pcb->perf.v[PERF_FRAME_ALLOCATIONS]++;
+    }
+
+    // Locked (page-table) frames, the frame being executed and the pages of
+    // processes running on other CPUs are never victims
+    bool evictable(int frame) const {
+        const FrameOwner& owner = frameOwners[frame];
+        if (!owner.pcb || mem.locked_frames.test(frame) || frame == core->executingFrame) return false;
+        if (mem.refCount[frame] > 1) {
+            for (const auto& mapping : sharedFrames.at(frame).mappings) {
+                if (mapping.first != core->currentPCB && mapping.first->state() == RUNNING) return false;
+            }
+            return true;
+        }
+        return owner.pcb == core->currentPCB || owner.pcb->state() != RUNNING;
+    }
+
+    PageTableEntry& ownerEntry(int frame) {
+        return frameOwners[frame].pcb->pageTable[frameOwners[frame].page];
+    }
+
+    // Clock test-and-clear of a frame's referenced bit. A shared frame was
+    // referenced when any job mapping it touched it.
+    bool testAndClearReferenced(int frame) {
+        if (mem.refCount[frame] <= 1) {
+            PageTableEntry& pte = ownerEntry(frame);
+            bool referenced = pte.referenced;
+            pte.referenced = false;
+            return referenced;
+        }
+        bool referenced = false;
+        for (const auto& mapping : sharedFrames.at(frame).mappings) {
+            PageTableEntry& pte = mapping.first->pageTable[mapping.second];
+            referenced |= pte.referenced;
+            pte.referenced = false;
+        }
+        return referenced;
+    }
+
+    // LRU age of a frame: the latest access through any of its mappings
+    long long frameLastUsed(int frame) {
+        if (mem.refCount[frame] <= 1) return ownerEntry(frame).lastUsed;
+        long long latest = 0;
+        for (const auto& mapping : sharedFrames.at(frame).mappings) {
+            latest = max(latest, mapping.first->pageTable[mapping.second].lastUsed);
+        }
+        return latest;
+    }
+
+    int selectVictim() {
+        int victim = -1;
+        switch (config.replacement) {
+            case REPLACE_CLOCK:
+                // Two sweeps at most: the first may only clear referenced bits
+                for (int step = 0; step < 2 * mem.frameCount; step++) {
+                    int frame = clockHand;
+                    clockHand = (clockHand + 1) % mem.frameCount;
+                    if (!evictable(frame)) continue;
+                    if (testAndClearReferenced(frame)) continue;
+                    return frame;
+                }
+                return -1;
+
+            case REPLACE_LRU: {
+                long long oldest = 0;
+                for (int frame = 0; frame < mem.frameCount; frame++) {
+                    if (!evictable(frame)) continue;
+                    long long lastUsed = frameLastUsed(frame);
+                    if (victim == -1 || lastUsed < oldest) {
+                        victim = frame;
+                        oldest = lastUsed;
+                    }
+                }
+                return victim;
+            }
+
+            case REPLACE_FIFO:
+                for (int frame = 0; frame < mem.frameCount; frame++) {
+                    if (evictable(frame) &&
+                        (victim == -1 || frameOwners[frame].loadSeq < frameOwners[victim].loadSeq)) {
+                        victim = frame;
+                    }
+                }
+                return victim;
+
+            default:
+                return -1;
+        }
+    }
+
+    // Push a victim page out to the drum and hand its frame to the caller.
+    // Clean program pages are not written, they reload from the card image.
+    int evictFrame() {
+        int frame = selectVictim();
+        if (frame == -1) {
+            MOS_LOG(LOG_ERROR, "No evictable frame");
+            return -1;
+        }
+
+        auto shared = sharedFrames.find(frame);
+        if (shared != sharedFrames.end()) {
+            // Shared pages are never dirty; every job mapping one reloads it
+            // (and may share it again) on its next touch
+            for (const auto& mapping : shared->second.mappings) {
+                PageTableEntry& pte = mapping.first->pageTable[mapping.second];
+                pte.valid = false;
+                pte.frame = -1;
+                pte.referenced = false;
+                pte.shared = false;
+                core->tlb.invalidate(mapping.first->deckSeq, mapping.second);
+            }
+            sharedPages.erase(shared->second.hash);
+            sharedFrames.erase(shared);
+            frameOwners[frame] = FrameOwner{};
+            pagingStats.evictions++;
+            MOS_LOG(LOG_TRACE, "Evicted shared program page from frame " + to_string(frame));
+            mem.releaseFrame(frame);
+            mem.claimFrame(frame);
+            return frame;
+        }
+
+        FrameOwner owner = frameOwners[frame];
+        PageTableEntry& pte = owner.pcb->pageTable[owner.page];
+        bool reloadable = config.demandPaging && owner.page < owner.pcb->programPages;
+        if (pte.dirty || (pte.swapSlot < 0 && !reloadable)) {
+            if (pte.swapSlot < 0) pte.swapSlot = swap.allocSlot();
+            const char* src = mem.data[frame * mem.pageSize];
+            copyBytes(swap.slotData(pte.swapSlot), src, mem.pageSize * WORD_SIZE);
+            pagingStats.swapOuts++;
+        }
+
+        pte.valid = false;
+        pte.frame = -1;
+        pte.dirty = false;
+        pte.referenced = false;
+        core->tlb.invalidate(owner.pcb->deckSeq, owner.page);
+        frameOwners[frame] = FrameOwner{};
+        pagingStats.evictions++;
+        MOS_LOG(LOG_TRACE, "Evicted page " + to_string(owner.page) + " of PID " +
+                to_string(owner.pcb->pid) + " from frame " + to_string(frame));
+
+        mem.releaseFrame(frame);
+        mem.claimFrame(frame);
+        return frame;
+    }
+
+    // This CPU's view of the clock: the shared timer plus what it ran since
+    // it last entered the kernel
+    long long now() const { return globalTimer + core->pendingTicks; }
+
+    // Record an access in the page's referenced/dirty/LRU state
+    void touchPage(PageTableEntry& pte, AccessType access) {
+        pte.referenced = true;
+        pte.lastUsed = now();
+        if (access == ACCESS_WRITE) pte.dirty = true;
+    }
+
+    // Address translation
+    bool addressMap(int VA, int& RA, AccessType access = ACCESS_READ) {
+        // Step 1: Validate virtual address range
+        if (VA < 0 || VA >= VIRTUAL_MEM_SIZE) {
+            MOS_LOG(LOG_ERROR, "Invalid VA: " + to_string(VA));
+            core->cpu.PI = PI_OPERAND_ERR;
+            return false;
+        }
+    
+        // Step 2: Calculate page and offset
+        int page = VA / mem.pageSize;
+        int offset = VA % mem.pageSize;
+        core->currentPCB->perf.v[PERF_TRANSLATIONS]++;
+
+        // Fast path: translation cached in the TLB. A write to a shared page
+        // takes the slow path to its copy-on-write fault.
+        const TLBEntry* cached = core->tlb.lookup(core->currentPCB->deckSeq, page);
+        if (cached && !(access == ACCESS_WRITE && cached->pte->shared)) {
+            touchPage(*cached->pte, access);
+            RA = cached->frame * mem.pageSize + offset;
+            MOS_LOG(LOG_TRACE, "TLB hit: VA=" + to_string(VA) + " → RA=" + to_string(RA));
+            return true;
+        }
+        if (!cached) core->currentPCB->perf.v[PERF_TLB_MISSES]++;
+        
+        // Step 3: Validate page number
+        if (page >= (int)core->currentPCB->pageTable.size()) {
+            MOS_LOG(LOG_ERROR, "Invalid page: " + to_string(page));
+            core->cpu.PI = PI_PAGE_FAULT;
+            core->faultPage = -1;
+            return false;
+        }
+    
+        // Step 4: Check page table entry
+        if (!core->currentPCB->pageTable[page].valid) {
+            MOS_LOG(LOG_TRACE, "Page not allocated: " + to_string(page));
+            core->cpu.PI = PI_PAGE_FAULT;
+            core->faultPage = page;
+            core->faultAccess = access;
+            return false;
+        }
+        if (access == ACCESS_WRITE && core->currentPCB->pageTable[page].shared) {
+            MOS_LOG(LOG_TRACE, "Write to shared page: " + to_string(page));
+            core->cpu.PI = PI_PAGE_FAULT;
+            core->faultPage = page;
+            core->faultAccess = access;
+            return false;
+        }
+    
+        int frame = core->currentPCB->pageTable[page].frame;
+        
+        // Step 5: Validate frame number
+        if (frame < 0 || frame >= mem.frameCount) {
+            MOS_LOG(LOG_ERROR, "Invalid frame: " + to_string(frame));
+            core->cpu.PI = PI_PAGE_FAULT;
+            return false;
+        }
+    
+        // Step 6: Calculate real address
+        RA = frame * mem.pageSize + offset;
+        
+        // Final validation
+        if (RA < 0 || RA >= mem.size) {
+            MOS_LOG(LOG_ERROR, "Invalid RA: " + to_string(RA));
+            core->cpu.PI = PI_OPERAND_ERR;
+            return false;
+        }
+    
+        touchPage(core->currentPCB->pageTable[page], access);
+        core->tlb.insert(core->currentPCB->deckSeq, page, frame, &core->currentPCB->pageTable[page]);
+        MOS_LOG(LOG_TRACE, "Successful mapping: VA=" + to_string(VA) + 
+                  " → page=" + to_string(page) + 
+                  " → frame=" + to_string(frame) + 
+                  " → RA=" + to_string(RA));
+        return true;
+    }
+
+    // I/O operations
+    // GD: copy the next data card into memory starting at core->cpu.RA, one word
+    // per WORD_SIZE characters, up to the end of that page
+    void handleRead() {
+        // Check data availability
+        if (core->currentPCB->dataCards.empty()) {
+            MOS_LOG(LOG_ERROR, "No more data cards");
+            terminate(EM_OUT_OF_DATA);
+            return;
+        }
+        if (startTransfer(hardwareISR.diskChannel, READ)) return;
+        readCard(core->currentPCB, core->cpu.RA);
+    }
+
+    // PD: print the words from core->cpu.RA to the end of that page as one line
+    void handleWrite() {
+        // Check line limit
+        core->currentPCB->LLC++;
+        if (core->currentPCB->LLC > core->currentPCB->TLL) {
+            MOS_LOG(LOG_ERROR, "Line limit exceeded (" + 
+                     to_string(core->currentPCB->LLC) + "/" + 
+                     to_string(core->currentPCB->TLL) + ")");
+            core->currentPCB->LLC--;
+            terminate(EM_LINE_LIMIT);
+            return;
+        }
+        if (startTransfer(hardwareISR.printerChannel, WRITE)) return;
+        printLine(core->currentPCB, core->cpu.RA);
+    }
+
+    // Charge a GD/PD to its channel. Synchronous I/O makes the CPU wait out
+    // the latency. Asynchronous I/O queues the transfer, blocks the process
+    // and frees the CPU; true when the process was blocked.
+    bool startTransfer(IOChannel& channel, SI_Type op) {
+        channel.requests++;
+        channel.busyTicks += config.ioLatency;
+        if (!config.asyncIO) {
+            globalTimer += config.ioLatency;
+            return false;
+        }
+
+        long long done = max<long long>(globalTimer, channel.freeAt) + config.ioLatency;
+        channel.freeAt = done;
+        mem.lockFrame(core->cpu.RA / mem.pageSize); // no eviction mid-transfer
+        channel.pending.push_back(IORequest{core->currentPCB, op, core->cpu.RA, done});
+        MOS_LOG(LOG_TRACE, "Process " + to_string(core->currentPCB->pid) + " blocked on I/O until tick " +
+                to_string(done));
+
+        core->cpu.SI = 0;
+        saveContext();
+        core->currentPCB->state() = BLOCKED;
+        core->currentPCB = nullptr;
+        return true;
+    }
+
+    void readCard(PCB* pcb, int RA) {
+        size_t length;
+        const char* card = pcb->dataCards.take(length);
+        MOS_LOG(LOG_TRACE, "Reading data: " + string(card, length));
+    
+        int pageEnd = (RA / mem.pageSize + 1) * mem.pageSize;
+
+        // Copy straight from the card arena, WORD_SIZE characters per word
+        for (size_t i = 0; i < length && RA < pageEnd; i += WORD_SIZE, RA++) {
+            mem.writeChars(RA, card + i, length - i);
+            MOS_LOG(LOG_TRACE, "Wrote '" + string(mem.data[RA], WORD_SIZE) + "' to RA " + to_string(RA));
+        }
+    }
+
+    void printLine(PCB* pcb, int RA) {
+        // Read from memory
+        string output;
+        int pageEnd = (RA / mem.pageSize + 1) * mem.pageSize;
+        for (; RA < pageEnd; RA++) {
+            for (int i = 0; i < WORD_SIZE; i++) {
+                if (mem.data[RA][i] != '\0') {
+                    output += mem.data[RA][i];
+                }
+            }
+        }
+        output.erase(output.find_last_not_of(' ') + 1);
+
+        // Spool the line; a full buffer is committed early
+        MOS_LOG(LOG_TRACE, "Wrote to output: " + output);
+        pcb->outputBuffer += output;
+        pcb->outputBuffer += '\n';
+        if ((int)pcb->outputBuffer.size() >= config.outputBufferBytes) {
+            commitOutput(pcb, false);
+        }
+    }
+    
+
+    // Give back a job's page-table frame, its resident pages and drum slots
+    void releaseFrames(PCB* pcb) {
+        if (pcb->PTR != -1) {
+            mem.releaseFrame(pcb->PTR / mem.pageSize);
+        }
+    
+        for (size_t page = 0; page < pcb->pageTable.size(); page++) {
+            PageTableEntry& entry = pcb->pageTable[page];
+            if (entry.valid) {
+                int frame = entry.frame;
+                // A shared frame stays with its other jobs
+                bool release = !entry.shared || unmapShared(pcb, (int)page, frame);
+                if (release && frame >= 0 && frame < mem.frameCount) {
+                    frameOwners[frame] = FrameOwner{};
+                    mem.releaseFrame(frame);
                 }
-                currentPCB->pageTable[i].valid = false;
+                entry.valid = false;
+            }
+            if (entry.swapSlot >= 0) {
+                swap.freeSlot(entry.swapSlot);
+                entry.swapSlot = -1;
             }
         }
+    }
+
+    // Termination handling
+    void terminate(EM_Code code) {
+        if (!core->currentPCB) return;
+    
+        // 1. Log termination details
+        MOS_LOG(LOG_INFO, "Terminating process " + to_string(core->currentPCB->pid));
+        appendReport(core->currentPCB, code);
+
+        // The job's output and report go to the printer as one block
+        commitOutput(core->currentPCB, true);
+
+        long long turnaround = globalTimer - core->currentPCB->admitTick;
+        schedulingStats.jobs++;
+        schedulingStats.turnaround += turnaround;
+        schedulingStats.waiting += max(0LL, turnaround - core->currentPCB->TTC());
+
+        foldPerf(core->currentPCB);
+        writePerfRecord("job", core->currentPCB->pid, core->currentPCB->perf);
+
+        if (config.recordJobs) {
+            chrono::duration<double, micro> turnaround = chrono::steady_clock::now() - core->currentPCB->admitTime;
+            jobRecords.push_back({core->currentPCB->pid, code, core->currentPCB->TTC(), core->currentPCB->admitTick,
+                                  globalTimer, turnaround.count()});
+        }
+    
+        // 2. Release all resources systematically
+        
+        // a) Release memory frames (including page table frame)
+        releaseFrames(core->currentPCB);
+        committedFrames -= core->currentPCB->workingSet;
+    
+        // Cached translations point at frames that are now free
+        core->tlb.flushProcess(core->currentPCB->deckSeq);
     
         // b) Clear CPU context if this was the current process
-        if (currentPCB->context.state == RUNNING) {
-            memset(&cpu, 0, sizeof(CPUState));
-            cpu.IC = 0;
-            cpu.TI = 0;
-            cpu.SI = 0;
-            cpu.PI = 0;
+        if (core->currentPCB->state() == RUNNING) {
+            core->cpu = CPUState();
         }
     
         // c) Clean up data cards
-        currentPCB->dataCards.clear();
-        currentPCB->dataCards.shrink_to_fit();
+        core->currentPCB->dataCards.clear();
     
         // 3. Update process state
-        currentPCB->terminated = true;
-        currentPCB->context.state = TERMINATED;
+        core->currentPCB->terminated = true;
+        core->currentPCB->state() = TERMINATED;
     
         // 4. Process cleanup and context switch
-        PCB* terminatedPCB = currentPCB;
-        currentPCB = nullptr;
+        PCB* terminatedPCB = core->currentPCB;
+        core->currentPCB = nullptr;
     
-        // Flush output before context switch
-        outFile.flush();
-    
-        // 5. Schedule next process or shutdown
-        if (!readyQueue.empty()) {
-            currentPCB = readyQueue.front();
-            readyQueue.pop();
-            
-            // Initialize new process context
-            currentPCB->context.state = RUNNING;
-            cpu.IC = 0;  // Start from beginning
-            
-            debugPrint("Switched to process " + to_string(currentPCB->pid));
-        } else {
-            debugPrint("No more processes in ready queue");
-            systemRunning = false;
+        // 5. Schedule next process or shutdown; freed frames may admit more jobs
+        admitJobs();
+        if (pickNext()) {
+            MOS_LOG(LOG_INFO, "Switched to process " + to_string(core->currentPCB->pid));
+        } else if (systemIdle()) {
+            MOS_LOG(LOG_INFO, "No more processes in ready queue");
+            stopSystem();
         }
     
         // 6. Final cleanup after state management
         if (terminatedPCB) {
             // Clear any remaining pointers
             terminatedPCB->PTR = -1;
-            memset(&terminatedPCB->context, 0, sizeof(ProcessContext));
             
-            // Delete the PCB
-            delete terminatedPCB;
+            // Free its slot for a later job
+            procs.release(terminatedPCB);
             terminatedPCB = nullptr;
         }
-    
-        // 7. Reset interrupt flags
-        cpu.TI = cpu.SI = cpu.PI = 0;
+    
+        // 7. Reset interrupt flags
+        core->cpu.TI = core->cpu.SI = core->cpu.PI = 0;
+    }
+public:
+    MOS(const string& inputPath, const string& outputPath,
+        const MOSConfig& cfg = MOSConfig())
+        : config(cfg), frameRng(cfg.seed), outputPath(outputPath), inFile(inputPath),
+          // A restored run keeps the output printed before its checkpoint
+          outFile(outputPath, cfg.restorePath.empty() ? ios::out : ios::in | ios::out),
+          input(inFile), output(outFile) {
+        if (!inFile.is_open()) {
+            throw runtime_error("Failed to open input file: " + inputPath);
+        }
+        if (config.mapInput) inputMap.open(inputPath);
+        if (!outFile.is_open()) {
+            throw runtime_error("Failed to open output file: " + outputPath);
+        }
+        init();
+    }
+
+    // Run a deck held in memory, or any other stream; the caller keeps both
+    // streams alive for the lifetime of the MOS
+    MOS(istream& in, ostream& out, const MOSConfig& cfg = MOSConfig())
+        : config(cfg), frameRng(cfg.seed), input(in), output(out) {
+        init();
+    }
+
+    // Run a deck already in memory, scanned in place like a mapped file;
+    // the buffer and out must outlive the MOS
+    MOS(const char* deck, size_t length, ostream& out, const MOSConfig& cfg = MOSConfig())
+        : config(cfg), frameRng(cfg.seed), input(noInput), output(out) {
+        inputMap.borrow(deck, length);
+        init();
+    }
+
+    ~MOS() {
+        stopPrinter();
+    }
+
+private:
+    void init() {
+        const MemoryGeometry& geometry = config.geometry;
+        if (config.cpus < 1 || config.cpus > 64) {
+            throw runtime_error("Invalid CPU count: " + to_string(config.cpus));
+        }
+        if (config.quantum < 1) {
+            throw runtime_error("Invalid quantum: " + to_string(config.quantum));
+        }
+        if (config.ioLatency < 0) {
+            throw runtime_error("Invalid I/O latency: " + to_string(config.ioLatency));
+        }
+        if ((!config.checkpointPath.empty() || !config.restorePath.empty()) && (config.cpus > 1 || config.asyncIO)) {
+            throw runtime_error("Checkpoints need a single CPU and synchronous I/O");
+        }
+        if (config.sharePages && !config.demandPaging) {
+            throw runtime_error("Page sharing needs demand paging");
+        }
+        if (geometry.pageSize < 1 || geometry.pageSize > VIRTUAL_MEM_SIZE || geometry.frameCount < 2) {
+            throw runtime_error("Invalid memory geometry: page size " + to_string(geometry.pageSize) +
+                                ", frames " + to_string(geometry.frameCount));
+        }
+        if (geometry.pageSize != DECK_PAGE_SIZE && !config.extendedISA) {
+            // A card or line is a page, so another size would change the output
+            throw runtime_error("Page size " + to_string(geometry.pageSize) + " needs --extended-isa; legacy decks use " +
+                                to_string(DECK_PAGE_SIZE) + "-word pages");
+        }
+        mem.init(geometry);
+        mem.extendedISA = config.extendedISA;
+        frameOwners.assign(mem.frameCount, FrameOwner{});
+        for (int va = 0; va < VIRTUAL_MEM_SIZE; va++) {
+            vaPage[va] = va / mem.pageSize;
+            vaOffset[va] = va % mem.pageSize;
+        }
+        swap.init(mem.pageSize);
+        processors = vector<Processor>(config.cpus);
+        for (size_t i = 0; i < processors.size(); i++) {
+            processors[i].id = (int)i;
+            processors[i].runQueue = makeScheduler(config, procs);
+        }
+        MOS_LOG(LOG_INFO, "MOS initialized with interrupt vector table, " + to_string(mem.frameCount) +
+                " frames of " + to_string(mem.pageSize) + " words");
+    }
+
+public:
+
+    // Cards past the page table are never loaded
+    int programPages(const JobCard& job) const {
+        int pages = ((int)job.programCards.size() + mem.pageSize - 1) / mem.pageSize;
+        return min(pages, mem.pagesPerProcess());
+    }
+
+    // Frames a job needs before it can start: its page table plus whatever
+    // the paging mode loads up front
+    int initialFrames(const JobCard& job) const {
+        if (config.demandPaging) return 2;
+        return 1 + programPages(job);
+    }
+
+    // Frames the job is expected to keep busy: page table, code and data
+    int workingSet(const JobCard& job) const {
+        return 1 + programPages(job) + config.dataPageEstimate;
+    }
+
+    bool fitsInMemory(const JobCard& job) const {
+        if (config.admission == ADMIT_FREE_FRAMES || config.replacement == REPLACE_NONE) {
+            if (mem.freeFrames < initialFrames(job)) return false;
+        }
+        return config.admission != ADMIT_WORKING_SET || committedFrames + workingSet(job) <= mem.frameCount;
+    }
+
+    // Long-term scheduler: move spooled jobs into the ready queue, in deck
+    // order, while they fit. The job at the head waits for terminations to
+    // free room; an idle system always takes it. A job that cannot fit
+    // even in an empty memory is rejected rather than ending the run.
+    void admitJobs() {
+        if (!spooler) return;
+        while (true) {
+            bool idle = systemIdle();
+            if (!hasPendingJob) {
+                if (!spooler->next(pendingJob)) return;
+                hasPendingJob = true;
+                deckResume = pendingJob.deckEnd;
+            }
+            if (initialFrames(pendingJob) > mem.frameCount) {
+                hasPendingJob = false;
+                rejectJob(pendingJob);
+                continue;
+            }
+            if (!idle && !fitsInMemory(pendingJob)) return;
+            if (!admitJob(pendingJob)) {
+                if (!idle) return;
+                rejectJob(pendingJob);
+            }
+            hasPendingJob = false;
+        }
+    }
+
+    // The end-of-job report, appended to the job's output
+    void appendReport(PCB* pcb, EM_Code code) {
+        string& report = pcb->outputBuffer;
+        report += "\n\nProcess " + to_string(pcb->pid) + " terminated: ";
+        report += terminationMessage(code);
+        report += "\nTTC: " + to_string(pcb->TTC()) + ", LLC: " + to_string(pcb->LLC) + "\n";
+        if (config.pagingReport) {
+            report += "Page faults: " + to_string(pcb->pageFaults) + ", Swap-ins: " +
+                      to_string(pcb->swapIns) + " (" + replacementName(config.replacement) + ")\n";
+        }
+    }
+
+    // Report a job that never ran, in its place in the output
+    void rejectJob(const JobCard& job) {
+        MOS_LOG(LOG_ERROR, "Job " + to_string(job.pid) + " needs more frames than memory has");
+        PCB* pcb = procs.acquire();
+        pcb->pid = job.pid;
+        pcb->deckSeq = admittedJobs++;
+        appendReport(pcb, EM_MEMORY_LIMIT);
+        commitOutput(pcb, true);
+        procs.release(pcb);
+        schedulingStats.rejected++;
+    }
+
+    // False when the frames ran out part way, with everything taken given
+    // back and the job card as it was
+    bool admitJob(JobCard& job) {
+        PCB* pcb = procs.acquire();
+        pcb->pid = job.pid;
+        pcb->TTL() = job.TTL;
+        pcb->TLL = job.TLL;
+        pcb->state() = READY;
+        pcb->admitTick = globalTimer;
+        if (config.recordJobs) pcb->admitTime = chrono::steady_clock::now();
+
+        // Initialize page table
+        pcb->pageTable.assign(mem.pagesPerProcess(), PageTableEntry{-1, false});
+
+        // Allocate frame for page table
+        int frame = allocateFrame();
+        if (frame == -1) {
+            MOS_LOG(LOG_ERROR, "Failed to allocate frame for page table");
+            procs.release(pcb);
+            return false;
+        }
+        pcb->PTR = frame * mem.pageSize;
+        pcb->perf.v[PERF_FRAME_ALLOCATIONS]++;
+        mem.lockFrame(frame);
+        MOS_LOG(LOG_TRACE, "Allocated frame " + to_string(frame) + " for page table");
+
+        // Estimated while the job card still holds the program
+        pcb->workingSet = workingSet(job);
+        pcb->programCards = move(job.programCards);
+        if (!loadProgramIntoMemory(pcb)) {
+            releaseFrames(pcb);
+            job.programCards = move(pcb->programCards);
+            procs.release(pcb);
+            return false;
+        }
+        pcb->dataCards = move(job.dataCards);
+
+        pcb->deckSeq = admittedJobs++;
+        committedFrames += pcb->workingSet;
+        pcb->priority() = job.priority;
+        leastLoadedCPU().runQueue->push(pcb, false);
+        workAvailable.notify_one();
+        MOS_LOG(LOG_INFO, "Added job " + to_string(pcb->pid) + " to ready queue");
+        return true;
+    }
+
+    // False when a program page found no frame
+    bool loadProgramIntoMemory(PCB* pcb) {
+        MOS_LOG(LOG_INFO, "Loading program into memory for PID " + to_string(pcb->pid));
+        MOS_LOG(LOG_TRACE, "Number of instructions: " + to_string(pcb->programCards.size()));
+        
+        // Calculate number of pages needed
+        int instructionsPerPage = mem.pageSize; // one instruction per word
+        int pagesNeeded = (pcb->programCards.size() + instructionsPerPage - 1) / instructionsPerPage;
+        pcb->programPages = min(pagesNeeded, (int)pcb->pageTable.size());
+        MOS_LOG(LOG_TRACE, "Instructions per page: " + to_string(instructionsPerPage) + 
+                  ", Pages needed: " + to_string(pagesNeeded));
+
+        // Initialize all page table entries as invalid
+        fill(pcb->pageTable.begin(), pcb->pageTable.end(), PageTableEntry{-1, false});
+
+        // With demand paging only the entry page is loaded, matching the two
+        // frames admission reserved; the rest stay non-resident until first touch
+        int eagerPages = config.demandPaging ? min(1, pcb->programPages) : pcb->programPages;
+
+        // Allocate frames for program
+        for (int i = 0; i < eagerPages; i++) {
+            if (shareProgramPage(pcb, i)) continue;
+            int frame = allocateFrame();
+            if (frame == -1) {
+                MOS_LOG(LOG_ERROR, "Failed to allocate frame for program page " + to_string(i));
+                return false;
+            }
+            
+            mapPage(pcb, i, frame);
+            MOS_LOG(LOG_TRACE, "Allocated frame " + to_string(frame) + " for page " + to_string(i));
+            loadProgramPage(pcb, i, frame);
+            offerProgramPage(pcb, i, frame);
+        }
+        return true;
+    }
+
+    // Program card j as one word: whitespace removed, padded or cut
+    void programWord(const PCB* pcb, int j, char* word) const {
+        size_t length;
+        const char* card = pcb->programCards.at(j, length);
+        size_t n = 0;
+        for (size_t k = 0; k < length && n < WORD_SIZE; k++) {
+            if (!isspace(static_cast<unsigned char>(card[k]))) word[n++] = card[k];
+        }
+        fill(word + n, word + WORD_SIZE, ' ');
+    }
+
+    // Copy one page of the program image into a frame
+    void loadProgramPage(PCB* pcb, int page, int frame) {
+        // Clear frame before use
+        mem.clearFrame(frame);
+
+        // Copy instructions to frame
+        int startInstr = page * mem.pageSize;
+        int endInstr = min(startInstr + mem.pageSize, (int)pcb->programCards.size());
+        
+        for (int j = startInstr; j < endInstr; j++) {
+            int addr = frame * mem.pageSize + (j - startInstr);
+            char word[WORD_SIZE];
+            programWord(pcb, j, word);
+            mem.storeInstruction(addr, word);
+            MOS_LOG(LOG_TRACE, "Loaded instruction: [" + string(word, WORD_SIZE) + "] at frame " + to_string(frame) + 
+                      " address " + to_string(addr));
+        }
+    }
+
+    // Enter the kernel from user mode: take the kernel lock and add the ticks
+    // this CPU ran since its last entry to the shared timer
+    void enterKernel(unique_lock<mutex>& kernel) {
+        kernel.lock();
+        globalTimer += core->pendingTicks;
+        core->pendingTicks = 0;
+        if (channelsBusy()) serviceChannels();
+        if (core->currentPCB) foldPerf(core->currentPCB);
+        if (core->traceRequestsSeen != traceDumpRequests) dumpTrace(TRACE_DUMP_REQUEST, -1);
+        if (config.perfInterval && globalTimer >= nextPerfDump) {
+            writePerfRecord("interval", -1, perfTotals);
+            nextPerfDump = (globalTimer / config.perfInterval + 1) * config.perfInterval;
+        }
+    }
+
+    void openTrace() {
+        if (!config.replayPath.empty()) {
+            if (config.cpus > 1) throw runtime_error("Trace replay needs a single CPU");
+            auto dumps = readTrace(config.replayPath);
+            if (dumps.empty() || dumps[0].second.empty()) throw runtime_error("Empty trace: " + config.replayPath);
+            // From the start that is the first dump. Resumed from a
+            // checkpoint it is the first dump that runs past it, without
+            // the records from before the checkpoint.
+            for (auto& dump : dumps) {
+                vector<TraceRecord>& records = dump.second;
+                auto start = find_if(records.begin(), records.end(),
+                                     [this](const TraceRecord& r) { return r.tick >= globalTimer; });
+                if (start == records.end()) continue;
+                replayRecords.assign(start, records.end());
+                break;
+            }
+            if (replayRecords.empty()) throw runtime_error("Trace ends before the restored checkpoint");
+            if (!config.traceRecords) config.traceRecords = (int)replayRecords.size();
+        }
+        if (!config.traceRecords) return;
+        for (Processor& p : processors) p.trace.init(config.traceRecords);
+        if (config.tracePath.empty() && !replayRecords.empty()) return;
+        string path = config.tracePath.empty() ? "trace.bin" : config.tracePath;
+        traceFile.open(path, ios::binary);
+        if (!traceFile) throw runtime_error("Failed to open trace file: " + path);
+        TraceFileHeader header = {{'M', 'O', 'S', 'T', 'R', 'A', 'C', 'E'}, TRACE_VERSION, sizeof(TraceRecord)};
+        traceFile.write((const char*)&header, sizeof header);
+        traceFile.flush();
+        signal(SIGUSR1, requestTraceDump);
+    }
+
+    // Write this CPU's ring to the trace file; kernel lock held
+    void dumpTrace(TraceDumpReason reason, int pid) {
+        core->traceRequestsSeen = traceDumpRequests;
+        if (!traceFile.is_open()) return;
+        const TraceRing& ring = core->trace;
+        TraceDumpHeader header = {(uint32_t)core->id, (uint32_t)reason, pid, (uint32_t)ring.size(), ring.recorded};
+        traceFile.write((const char*)&header, sizeof header);
+        for (size_t i = 0; i < ring.size(); i++) traceFile.write((const char*)&ring.at(i), sizeof(TraceRecord));
+        traceFile.flush();
+        MOS_LOG(LOG_INFO, "Trace: dumped " + to_string(ring.size()) + " records from CPU " + to_string(core->id));
+        if (!tracePinned && !config.checkpointPath.empty()) pinCheckpoint();
+    }
+
+    // Link the latest checkpoint as PATH.replay, so later checkpoints
+    // replace the file but not the state this dump can be replayed from.
+    // Dumps before the first checkpoint can only be replayed from the start.
+    void pinCheckpoint() {
+        string pinned = config.checkpointPath + ".replay";
+        unlink(pinned.c_str());
+        if (link(config.checkpointPath.c_str(), pinned.c_str()) != 0) return;
+        tracePinned = true;
+        MOS_LOG(LOG_INFO, "Trace: replay this dump with --restore=" + pinned);
+    }
+
+    // Record the instruction just executed at RA; runs without the kernel lock
+    void recordTrace(const DecodedInstr& instr, int RA, long long tick) {
+        TraceRecord& r = core->trace.next();
+        r.tick = tick;
+        r.pid = core->currentPCB->pid;
+        r.RA = RA;
+        r.IC = (int16_t)(core->cpu.IC - 1);
+        r.operand = (int16_t)instr.operand;
+        r.op = instr.op;
+        r.interrupts = (uint8_t)pendingInterrupts();
+        if (!replayRecords.empty()) checkReplay(r);
+    }
+
+    // Follow the replayed trace from its first record on
+    void checkReplay(const TraceRecord& r) {
+        if (replayDiverged || replayMatched == replayRecords.size()) return;
+        const TraceRecord& expected = replayRecords[replayMatched];
+        if (sameTraceRecord(r, expected)) {
+            replayMatched++;
+        } else if (replayMatched) {
+            replayDiverged = true;
+            cout << "Replay diverged after " << replayMatched << " records\nexpected: ";
+            printTraceRecord(cout, expected);
+            cout << "     got: ";
+            printTraceRecord(cout, r);
+        }
+    }
+
+    void reportReplay() {
+        if (replayRecords.empty() || replayDiverged) return;
+        if (replayMatched == replayRecords.size()) {
+            cout << "Replay reproduced all " << replayMatched << " trace records" << endl;
+        } else {
+            cout << "Replay stopped after " << replayMatched << " of " << replayRecords.size() << " trace records" << endl;
+        }
+    }
+
+    // Options a checkpoint only restores under, since they shape the state
+    vector<int32_t> snapshotOptions() const {
+        return {config.geometry.pageSize, config.geometry.frameCount, config.cpus, (int32_t)config.scheduling,
+                config.quantum, config.mlfqLevels, (int32_t)config.replacement, config.demandPaging,
+                (int32_t)config.placement, config.deckOrderOutput, config.sharePages,
+                (int32_t)config.admission, config.dataPageEstimate, config.extendedISA};
+    }
+
+    bool checkpointDue() const {
+        return !config.checkpointPath.empty() &&
+               (globalTimer >= nextCheckpoint || checkpointRequestsSeen != checkpointRequests);
+    }
+
+    // Write the whole machine to config.checkpointPath. Runs under the
+    // kernel lock between instructions, with the running process's
+    // registers still on the CPU. The file is replaced atomically, so the
+    // latest complete checkpoint always survives a crash.
+    void writeCheckpoint() {
+        settleTimer();
+        checkpointRequestsSeen = checkpointRequests;
+        if (config.checkpointInterval) {
+            nextCheckpoint = (globalTimer / config.checkpointInterval + 1) * config.checkpointInterval;
+        }
+        // Everything committed so far must be in the file the checkpoint points into
+        stopPrinter();
+        startPrinter();
+        long long outputBytes = outFile.is_open() ? (long long)output.tellp() : -1;
+        if (outputBytes < 0) throw runtime_error("Checkpoints need a file-backed output");
+
+        Processor& cpu = processors[0];
+        vector<PCB*> live;
+        if (cpu.currentPCB) live.push_back(cpu.currentPCB);
+        vector<PCB*> queued = cpu.runQueue->queued();
+        live.insert(live.end(), queued.begin(), queued.end());
+        unordered_map<const PCB*, int> index;
+        for (size_t i = 0; i < live.size(); i++) index[live[i]] = (int)i;
+        auto indexOf = [&](const PCB* pcb) { return pcb ? index.at(pcb) : -1; };
+
+        SnapshotWriter w;
+        SnapshotHeader header = {{'M', 'O', 'S', 'S', 'N', 'A', 'P', 0}, SNAPSHOT_VERSION, {}};
+        vector<int32_t> options = snapshotOptions();
+        copy(options.begin(), options.end(), header.options);
+        w.put(header);
+
+        w.put<long long>(globalTimer);
+        w.put<uint64_t>(hasPendingJob ? pendingJob.deckStart : deckResume);
+        w.put(admittedJobs);
+        w.put(pagingStats);
+        w.put(schedulingStats);
+        w.put(perfTotals);
+        ostringstream rng;
+        rng << frameRng;
+        w.putString(rng.str());
+
+        // Memory, the drum and the frame map
+        w.putBytes(mem.store.get(), size_t(mem.size) * WORD_SIZE);
+        w.putBytes(mem.allocated.bits.data(), mem.allocated.bits.size() * sizeof(uint64_t));
+        w.putBytes(mem.locked_frames.bits.data(), mem.locked_frames.bits.size() * sizeof(uint64_t));
+        w.putBytes(mem.pinCount.data(), mem.pinCount.size() * sizeof(int));
+        w.put(mem.freeFrames);
+        w.putString(string(swap.drum.begin(), swap.drum.end()));
+        w.putBytes(swap.freeSlots.data(), swap.freeSlots.size() * sizeof(int));
+        w.put(frameLoadSeq);
+        w.put(clockHand);
+
+        // Live processes: the running one first, then the run queue in order
+        w.put<uint64_t>(live.size());
+        for (const PCB* pcb : live) {
+            w.put(pcb->pid);
+            w.put(pcb->TTL());
+            w.put(pcb->TLL);
+            w.put(pcb->TTC());
+            w.put(pcb->LLC);
+            w.putBytes(pcb->pageTable.data(), pcb->pageTable.size() * sizeof(PageTableEntry));
+            w.put(pcb->PTR);
+            w.putCards(pcb->dataCards);
+            w.putString(pcb->outputBuffer);
+            w.putCards(pcb->programCards);
+            w.put(pcb->programPages);
+            w.put(pcb->pageFaults);
+            w.put(pcb->swapIns);
+            w.put(pcb->deckSeq);
+            w.put(pcb->admitTick);
+            w.put(pcb->context.cpu);
+            w.put(pcb->context.saved);
+            w.put(pcb->state());
+            w.put(pcb->priority());
+            w.put(pcb->schedLevel);
+            w.put(pcb->schedEpoch);
+            w.put(pcb->workingSet);
+            w.put<unsigned long>(pcb->interruptMask.to_ulong());
+            w.put(pcb->perf);
+            w.put(pcb->perfFolded);
+        }
+        for (const FrameOwner& owner : frameOwners) {
+            w.put<int32_t>(indexOf(owner.pcb));
+            w.put(owner.page);
+            w.put(owner.loadSeq);
+        }
+        w.putBytes(mem.refCount.data(), mem.refCount.size() * sizeof(int));
+        w.put<uint64_t>(sharedFrames.size());
+        for (const auto& shared : sharedFrames) {
+            w.put(shared.first);
+            w.put<uint64_t>(shared.second.mappings.size());
+            for (const auto& mapping : shared.second.mappings) {
+                w.put<int32_t>(indexOf(mapping.first));
+                w.put(mapping.second);
+            }
+        }
+
+        // The CPU, its TLB and run-queue policy state
+        w.put(cpu.cpu);
+        w.put(cpu.sliceUsed);
+        w.put(cpu.instructions);
+        w.put(cpu.tlb.hits);
+        w.put(cpu.tlb.misses);
+        for (const TLBEntry& entry : cpu.tlb.entries) {
+            int owner = -1;
+            for (size_t i = 0; entry.pte && i < live.size(); i++) {
+                const vector<PageTableEntry>& table = live[i]->pageTable;
+                if (entry.pte >= table.data() && entry.pte < table.data() + table.size()) owner = (int)i;
+            }
+            w.put<int32_t>(owner);
+            w.put(entry.page);
+            w.put(entry.frame);
+        }
+        vector<long long> policy = cpu.runQueue->state();
+        w.putBytes(policy.data(), policy.size() * sizeof(long long));
+
+        // Output spool
+        w.put(outputBytes);
+        w.put<int32_t>(indexOf(outputOwner));
+        w.put<uint64_t>(heldOutput.size());
+        for (const string& block : heldOutput) w.putString(block);
+        w.put<uint64_t>(finishedOutput.size());
+        for (const auto& entry : finishedOutput) {
+            w.put(entry.first);
+            w.putString(entry.second);
+        }
+        w.put(nextDeckSeq);
+
+        string temp = config.checkpointPath + ".tmp";
+        {
+            ofstream file(temp, ios::binary | ios::trunc);
+            file.write(w.buffer.data(), w.buffer.size());
+            if (!file.flush()) throw runtime_error("Failed to write checkpoint: " + temp);
+        }
+        if (rename(temp.c_str(), config.checkpointPath.c_str()) != 0) {
+            throw runtime_error("Failed to replace checkpoint: " + config.checkpointPath);
+        }
+        MOS_LOG(LOG_INFO, "Checkpoint at tick " + to_string(globalTimer) + ": " + to_string(live.size()) +
+                " processes, " + to_string(w.buffer.size()) + " bytes");
+    }
+
+    // Load config.restorePath into a freshly initialized MOS and return the
+    // input offset to resume spooling from. The file is read through a
+    // mapping, most of it (memory, the drum) in single copies.
+    size_t restoreCheckpoint() {
+        MappedFile file;
+        if (!file.open(config.restorePath)) throw runtime_error("Failed to open checkpoint: " + config.restorePath);
+        SnapshotReader r = {file.data(), file.data() + file.size()};
+
+        SnapshotHeader header = r.get<SnapshotHeader>();
+        if (memcmp(header.magic, "MOSSNAP", 8) != 0) throw runtime_error("Not a checkpoint: " + config.restorePath);
+        if (header.version != SNAPSHOT_VERSION) {
+            throw runtime_error("Unsupported checkpoint version " + to_string(header.version));
+        }
+        vector<int32_t> options = snapshotOptions();
+        if (!equal(options.begin(), options.end(), header.options)) {
+            throw runtime_error("Checkpoint was taken with different memory or scheduling options");
+        }
+        if (outputPath.empty()) throw runtime_error("Restoring needs a file-backed output");
+
+        globalTimer = r.get<long long>();
+        size_t deckStart = r.get<uint64_t>();
+        admittedJobs = r.get<long long>();
+        pagingStats = r.get<PagingStats>();
+        schedulingStats = r.get<SchedulingStats>();
+        perfTotals = r.get<PerfCounters>();
+        istringstream rng(r.getString());
+        rng >> frameRng;
+
+        size_t length;
+        const char* bytes = r.getBytes(length);
+        if (length != size_t(mem.size) * WORD_SIZE) throw runtime_error("Checkpoint memory size mismatch");
+        memcpy(mem.store.get(), bytes, length);
+        bytes = r.getBytes(length);
+        memcpy(mem.allocated.bits.data(), bytes, min(length, mem.allocated.bits.size() * sizeof(uint64_t)));
+        bytes = r.getBytes(length);
+        memcpy(mem.locked_frames.bits.data(), bytes, min(length, mem.locked_frames.bits.size() * sizeof(uint64_t)));
+        bytes = r.getBytes(length);
+        if (length != mem.pinCount.size() * sizeof(int)) throw runtime_error("Corrupt checkpoint");
+        memcpy(mem.pinCount.data(), bytes, length);
+        mem.freeFrames = r.get<int>();
+        bytes = r.getBytes(length);
+        swap.drum.assign(bytes, bytes + length);
+        bytes = r.getBytes(length);
+        swap.freeSlots.resize(length / sizeof(int));
+        memcpy(swap.freeSlots.data(), bytes, length);
+        frameLoadSeq = r.get<long long>();
+        clockHand = r.get<int>();
+
+        vector<PCB*> live(r.get<uint64_t>());
+        for (PCB*& pcb : live) {
+            pcb = procs.acquire();
+            pcb->pid = r.get<int>();
+            pcb->TTL() = r.get<int>();
+            pcb->TLL = r.get<int>();
+            pcb->TTC() = r.get<int>();
+            pcb->LLC = r.get<int>();
+            bytes = r.getBytes(length);
+            pcb->pageTable.resize(length / sizeof(PageTableEntry));
+            memcpy(pcb->pageTable.data(), bytes, length);
+            pcb->PTR = r.get<int>();
+            r.getCards(pcb->dataCards);
+            pcb->outputBuffer = r.getString();
+            r.getCards(pcb->programCards);
+            pcb->programPages = r.get<int>();
+            pcb->pageFaults = r.get<int>();
+            pcb->swapIns = r.get<int>();
+            pcb->deckSeq = r.get<long long>();
+            pcb->admitTick = r.get<long long>();
+            pcb->admitTime = chrono::steady_clock::now();
+            pcb->context.cpu = r.get<CPUState>();
+            pcb->context.saved = r.get<bool>();
+            pcb->state() = r.get<ProcessState>();
+            pcb->priority() = r.get<int>();
+            pcb->schedLevel = r.get<int>();
+            pcb->schedEpoch = r.get<long long>();
+            pcb->workingSet = r.get<int>();
+            committedFrames += pcb->workingSet;
+            pcb->interruptMask = bitset<NUM_INTERRUPTS>(r.get<unsigned long>());
+            pcb->perf = r.get<PerfCounters>();
+            pcb->perfFolded = r.get<PerfCounters>();
+        }
+        auto pcbAt = [&](int32_t i) -> PCB* {
+            if (i < -1 || i >= (int32_t)live.size()) throw runtime_error("Corrupt checkpoint");
+            return i < 0 ? nullptr : live[i];
+        };
+        for (FrameOwner& owner : frameOwners) {
+            owner.pcb = pcbAt(r.get<int32_t>());
+            owner.page = r.get<int>();
+            owner.loadSeq = r.get<long long>();
+        }
+        bytes = r.getBytes(length);
+        if (length != mem.refCount.size() * sizeof(int)) throw runtime_error("Corrupt checkpoint");
+        memcpy(mem.refCount.data(), bytes, length);
+        for (size_t n = r.get<uint64_t>(); n > 0; n--) {
+            int frame = r.get<int>();
+            SharedFrame& shared = sharedFrames[frame];
+            shared.hash = hashPage(mem.data[frame * mem.pageSize]);
+            shared.mappings.resize(r.get<uint64_t>());
+            for (auto& mapping : shared.mappings) {
+                mapping.first = pcbAt(r.get<int32_t>());
+                mapping.second = r.get<int>();
+            }
+            sharedPages[shared.hash] = frame;
+        }
+
+        Processor& cpu = processors[0];
+        cpu.cpu = r.get<CPUState>();
+        cpu.sliceUsed = r.get<int>();
+        cpu.instructions = r.get<long long>();
+        cpu.tlb.hits = r.get<long long>();
+        cpu.tlb.misses = r.get<long long>();
+        for (TLBEntry& entry : cpu.tlb.entries) {
+            PCB* owner = pcbAt(r.get<int32_t>());
+            int page = r.get<int>();
+            int frame = r.get<int>();
+            entry = owner ? TLBEntry{owner->deckSeq, page, frame, &owner->pageTable.at(page)} : TLBEntry{};
+        }
+        bytes = r.getBytes(length);
+        vector<long long> policy(length / sizeof(long long));
+        memcpy(policy.data(), bytes, length);
+        cpu.runQueue->setState(policy);
+        // The running process only left the CPU in the file
+        if (!live.empty() && live[0]->state() == RUNNING) cpu.currentPCB = live[0];
+        for (size_t i = cpu.currentPCB ? 1 : 0; i < live.size(); i++) cpu.runQueue->push(live[i], false);
+
+        long long outputBytes = r.get<long long>();
+        outputOwner = pcbAt(r.get<int32_t>());
+        heldOutput.resize(r.get<uint64_t>());
+        for (string& block : heldOutput) block = r.getString();
+        for (size_t n = r.get<uint64_t>(); n > 0; n--) {
+            long long seq = r.get<long long>();
+            finishedOutput[seq] = r.getString();
+        }
+        nextDeckSeq = r.get<long long>();
+        if (truncate(outputPath.c_str(), outputBytes) != 0) {
+            throw runtime_error("Failed to rewind output to the checkpoint: " + outputPath);
+        }
+        output.seekp(outputBytes);
+
+        MOS_LOG(LOG_INFO, "Restored checkpoint at tick " + to_string(globalTimer) + ": " + to_string(live.size()) +
+                " processes");
+        return deckStart;
+    }
+
+    // Add what pcb counted since the last fold to the totals; kernel lock held
+    void foldPerf(PCB* pcb) {
+        for (int i = 0; i < PERF_COUNT; i++) {
+            perfTotals.v[i] += pcb->perf.v[i] - pcb->perfFolded.v[i];
+        }
+        pcb->perfFolded = pcb->perf;
+    }
+
+    void openPerf() {
+        perfTiming = config.perfFormat != PERF_OFF;
+        if (!perfTiming) return;
+        string path = config.perfPath.empty() ? string("perf.") + perfFormatName(config.perfFormat) : config.perfPath;
+        perfFile.open(path);
+        if (!perfFile) throw runtime_error("Failed to open perf file: " + path);
+        if (config.perfFormat == PERF_JSON) {
+            perfFile << "[";
+        } else {
+            perfFile << "type,tick,cycles,pid";
+            for (int i = 0; i < PERF_COUNT; i++) perfFile << ',' << perfCounterName(i);
+            perfFile << '\n';
+        }
+        perfStartCycles = cycleCount();
+        nextPerfDump = config.perfInterval;
+    }
+
+    void closePerf() {
+        if (!perfFile.is_open()) return;
+        writePerfRecord("total", -1, perfTotals);
+        if (config.perfFormat == PERF_JSON) perfFile << "\n]\n";
+        perfFile.close();
+    }
+
+    // One record: a job at termination (pid >= 0), an interval or the total
+    void writePerfRecord(const char* type, int pid, const PerfCounters& counters) {
+        if (!perfFile.is_open()) return;
+        unsigned long long cycles = cycleCount() - perfStartCycles;
+        if (config.perfFormat == PERF_JSON) {
+            perfFile << (perfRecords ? ",\n" : "\n") << "{\"type\":\"" << type << "\",\"tick\":" << globalTimer
+                     << ",\"cycles\":" << cycles;
+            if (pid >= 0) perfFile << ",\"pid\":" << pid;
+            for (int i = 0; i < PERF_COUNT; i++) perfFile << ",\"" << perfCounterName(i) << "\":" << counters.v[i];
+            perfFile << '}';
+        } else {
+            perfFile << type << ',' << globalTimer << ',' << cycles << ',';
+            if (pid >= 0) perfFile << pid;
+            for (int i = 0; i < PERF_COUNT; i++) perfFile << ',' << counters.v[i];
+            perfFile << '\n';
+        }
+        perfRecords++;
+    }
+
+    // Called and returns with the kernel lock held; instructions run unlocked
+    void executeJob(unique_lock<mutex>& kernel) {
+        if (!core->currentPCB || core->currentPCB->terminated) {
+            return;
+        }
+
+        MOS_LOG(LOG_INFO, "Executing job PID " + to_string(core->currentPCB->pid));
+        core->currentPCB->state() = RUNNING;
+        armTimer(); // a restored checkpoint resumes here without a dispatch
+        kernel.unlock();
+
+        // Trace logging and the trace ring both need every instruction to
+        // go through the general loop
+        bool tracing = core->trace.enabled();
+        bool threaded = config.threadedCore && !tracing && !(LOG_TRACE <= COMPILED_LOG_LEVEL && LOG_TRACE <= runtimeLogLevel);
+        // Job errors are interrupts. An exception here is a kernel failure,
+        // such as a checkpoint that cannot be written or a bad card met by
+        // admission, and it ends the run.
+        while (!core->currentPCB->terminated) {
+            if (threaded) runThreaded();
+            if (core->timerLeft <= 0) {
+                enterKernel(kernel);
+                core->cpu.TI = 1;
+                handleInterrupt();
+                if (!core->currentPCB) return;
+                if (checkpointDue()) writeCheckpoint();
+                kernel.unlock();
+                continue;
+            }
+
+            // Map virtual address (IC) to real address
+            unsigned long long fetchStart = perfTiming ? cycleCount() : 0;
+            int realAddr;
+            if (!addressMap(core->cpu.IC, realAddr, ACCESS_FETCH)) {
+                MOS_LOG(LOG_TRACE, "Failed to map instruction address");
+                enterKernel(kernel);
+                handleInterrupt();
+                if (!core->currentPCB) return;
+                if (core->yieldRequested) {
+                    yieldCPU();
+                    return;
+                }
+                kernel.unlock();
+                continue;
+            }
+            
+            // Fetch instruction into IR, decoded form comes from the cache
+            copyWord(core->cpu.IR, mem.data[realAddr]);
+            core->executingFrame = realAddr / mem.pageSize;
+            unsigned long long decodeStart = perfTiming ? cycleCount() : 0;
+            const DecodedInstr& instr = mem.fetchDecoded(realAddr);
+            core->executingOp = instr.op;
+
+            MOS_LOG(LOG_TRACE, "Fetched instruction: [" + string(core->cpu.IR, WORD_SIZE) + "] from address " + to_string(realAddr));
+            
+            core->cpu.IC++;  // Increment instruction counter
+
+            // Execute the instruction
+            unsigned long long executeStart = perfTiming ? cycleCount() : 0;
+            executeInstruction(instr);
+            PerfCounters& perf = core->currentPCB->perf;
+            if (perfTiming) {
+                unsigned long long executeEnd = cycleCount();
+                perf.v[PERF_CYCLES_FETCH] += decodeStart - fetchStart;
+                perf.v[PERF_CYCLES_DECODE] += executeStart - decodeStart;
+                perf.v[PERF_CYCLES_EXECUTE] += executeEnd - executeStart;
+            }
+            perf.v[PERF_RETIRED + instr.op]++;
+            if (tracing) recordTrace(instr, realAddr, now());
+            
+            // Update timers
+            core->currentPCB->TTC()++;
+            core->pendingTicks++;
+            core->instructions++;
+            core->timerLeft--;
+
+            // Handle interrupts; the timer is taken at the top of the loop
+            if (!core->cpu.SI && !core->cpu.PI) continue;
+
+            enterKernel(kernel);
+            handleInterrupt();
+            if (!core->currentPCB || core->currentPCB->terminated) {
+                return;
+            }
+            if (core->yieldRequested) {
+                yieldCPU();
+                return;
+            }
+            // A restarted instruction gave its tick back, and a transfer
+            // may have been queued
+            armTimer();
+            if (checkpointDue()) writeCheckpoint();
+            kernel.unlock();
+        }
+        if (!kernel.owns_lock()) enterKernel(kernel);
+    }
+
+    // Threaded interpreter for the common case, run ahead of the general
+    // loop in executeJob(). It retires LR/SR/CR/BT whose fetch and operand
+    // both hit the TLB, exactly as the general loop would, counting down
+    // the CPU's interval timer. At the first instruction it cannot finish
+    // alone (GD/PD/H, a bad opcode or operand, a TLB miss, the timer at
+    // zero) it returns with that instruction not started.
+#if MOS_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // labels as values are a GNU extension
+#endif
+    void runThreaded() {
+        PCB* pcb = core->currentPCB;
+        long long* retired = pcb->perf.v + PERF_RETIRED;
+        CPUState& cpu = core->cpu;
+        TLB& tlb = core->tlb;
+        const long long asid = pcb->deckSeq;
+        const int pageSize = mem.pageSize;
+        long long budget = core->timerLeft;
+        if (budget <= 0) return;
+
+#if MOS_COMPUTED_GOTO
+        static void* const handlers[] = {
+            &&leave,   // OP_INVALID
+            &&leave,   // OP_GD
+            &&leave,   // OP_PD
+            &&leave,   // OP_H
+            &&op_lr, &&op_sr, &&op_cr, &&op_bt,
+            &&leave, &&leave, &&leave, &&leave, &&leave  // extended set, general loop only
+        };
+        static_assert(sizeof handlers / sizeof handlers[0] == OP_COUNT, "one handler per opcode");
+#endif
+
+        const long long start = now();
+        const unsigned long long started = perfTiming ? cycleCount() : 0;
+        long long executed = 0;
+        const TLBEntry* code = nullptr;
+        const TLBEntry* operand = nullptr;
+        const DecodedInstr* instr = nullptr;
+        int fetchAddr = 0;
+        int retiredAddr = 0;
+        int realAddr = 0;
+
+        // Fetch and translate the next instruction; false sends it to the
+        // general loop
+        auto fetch = [&]() {
+            if (executed == budget || cpu.IC < 0 || cpu.IC >= VIRTUAL_MEM_SIZE) return false;
+            code = tlb.probe(asid, vaPage[cpu.IC]);
+            if (!code) return false;
+            fetchAddr = code->frame * pageSize + vaOffset[cpu.IC];
+            instr = &mem.fetchDecoded(fetchAddr);
+            if (instr->operand < 0 || instr->operand >= VIRTUAL_MEM_SIZE || instr->op < OP_LR) return false;
+            operand = tlb.probe(asid, vaPage[instr->operand]);
+            if (!operand) return false;
+            realAddr = operand->frame * pageSize + vaOffset[instr->operand];
+            return true;
+        };
+
+        // Commit the fetch and the operand access the general loop charges
+        // for the instruction
+        auto retire = [&](AccessType access) {
+            long long tick = start + executed;
+            tlb.hits += 2;
+            code->pte->referenced = true;
+            code->pte->lastUsed = tick;
+            operand->pte->referenced = true;
+            operand->pte->lastUsed = tick;
+            if (access == ACCESS_WRITE) operand->pte->dirty = true;
+            copyWord(cpu.IR, mem.data[fetchAddr]);
+            retiredAddr = fetchAddr;
+            retired[instr->op]++;
+            cpu.IC++;
+            executed++;
+        };
+
+        // Run the translated block starting at IC, if it is still valid and
+        // fits the countdown. It charges everything the instructions would.
+        auto runBlock = [&]() {
+            if (!config.blockCache || cpu.IC < 0 || cpu.IC >= VIRTUAL_MEM_SIZE) return false;
+            TranslatedBlock* block = findBlock(pcb, cpu.IC);
+            long long length = block ? (long long)block->ops.size() : 0;
+            if (!length || length > budget - executed) return false;
+            for (TranslatedBlock::Page& p : block->pages) {
+                const TLBEntry* entry = tlb.probe(asid, p.page);
+                if (!entry) return false;
+                if (entry->frame != p.frame) {
+                    block->translated = false; // an operand page moved
+                    return false;
+                }
+                if (p.written && entry->pte->shared) return false;
+                p.pte = entry->pte;
+            }
+
+            int next = block->endVA;
+            for (const TranslatedBlock::Op& op : block->ops) {
+                retired[op.op]++;
+                switch (op.op) {
+                    case OP_LR:
+                        copyWord(cpu.R, mem.data[op.realAddr]);
+                        break;
+                    case OP_SR:
+                        mem.writeWord(op.realAddr, op.realAddr / pageSize, cpu.R);
+                        break;
+                    case OP_CR:
+                        cpu.C = sameWord(cpu.R, mem.data[op.realAddr]);
+                        break;
+                    case OP_BT:
+                        if (cpu.C) next = op.target;
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            long long tick = start + executed;
+            for (const TranslatedBlock::Page& p : block->pages) {
+                p.pte->referenced = true;
+                p.pte->lastUsed = tick + p.lastOp;
+                if (p.written) p.pte->dirty = true;
+            }
+            tlb.hits += 2 * length;
+            copyWord(cpu.IR, mem.data[block->lastFetch]);
+            retiredAddr = block->lastFetch;
+            cpu.IC = next;
+            executed += length;
+            core->blocks.runs++;
+            return true;
+        };
+
+#if MOS_COMPUTED_GOTO
+#define MOS_DISPATCH() do { if (!fetch()) goto leave; goto *handlers[instr->op]; } while (0)
+#else
+#define MOS_DISPATCH() goto dispatch
+#endif
+        while (runBlock()) {}
+        MOS_DISPATCH();
+
+#if !MOS_COMPUTED_GOTO
+    dispatch:
+        if (!fetch()) goto leave;
+        switch (instr->op) {
+            case OP_LR: goto op_lr;
+            case OP_SR: goto op_sr;
+            case OP_CR: goto op_cr;
+            case OP_BT: goto op_bt;
+            default: goto leave;  // extended set, general loop only
+        }
+#endif
+
+    op_lr:
+        retire(ACCESS_READ);
+        copyWord(cpu.R, mem.data[realAddr]);
+        MOS_DISPATCH();
+    op_sr:
+        if (operand->pte->shared) goto leave; // copy-on-write fault first
+        retire(ACCESS_WRITE);
+        mem.writeWord(realAddr, operand->frame, cpu.R);
+        MOS_DISPATCH();
+    op_cr:
+        retire(ACCESS_READ);
+        cpu.C = sameWord(cpu.R, mem.data[realAddr]);
+        MOS_DISPATCH();
+    op_bt:
+        retire(ACCESS_READ);
+        if (cpu.C) cpu.IC = instr->operand;
+        while (runBlock()) {}
+        MOS_DISPATCH();
+#undef MOS_DISPATCH
+
+    leave:
+        if (!executed) return;
+        pcb->perf.v[PERF_TRANSLATIONS] += 2 * executed;
+        if (perfTiming) pcb->perf.v[PERF_CYCLES_EXECUTE] += cycleCount() - started;
+        core->executingFrame = retiredAddr / pageSize;
+        pcb->TTC() += executed;
+        core->pendingTicks += executed;
+        core->instructions += executed;
+        core->timerLeft -= executed;
     }
-public:
-    MOS(const string& input, const string& output) 
-        : inFile(input), outFile(output) {
-        if (!inFile.is_open()) {
-            throw runtime_error("Failed to open input file: " + input);
+#if MOS_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+    // The cached block of pcb at va. A block is translated the second time
+    // execution reaches va with the same code: the same code frame, not
+    // written or reloaded since (Memory::frameGen). Under heavy paging the
+    // code keeps changing and nothing is translated.
+    TranslatedBlock* findBlock(const PCB* pcb, int va) {
+        TranslatedBlock& block = core->blocks.slot(pcb->deckSeq, va);
+        const PageTableEntry& code = pcb->pageTable[vaPage[va]];
+        if (!code.valid) return nullptr;
+        unsigned gen = mem.frameGen[code.frame];
+        if (block.asid != pcb->deckSeq || block.startVA != va || block.codeFrame != code.frame || block.codeGen != gen) {
+            block.asid = pcb->deckSeq;
+            block.startVA = va;
+            block.codeFrame = code.frame;
+            block.codeGen = gen;
+            block.translated = false;
+            return nullptr;
         }
-        if (!outFile.is_open()) {
-            throw runtime_error("Failed to open output file: " + output);
+        if (!block.translated || (block.waitPage >= 0 && pcb->pageTable[block.waitPage].valid)) {
+            translateBlock(pcb, block);
         }
-        initInterruptVectorTable();
-        debugPrint("MOS initialized with interrupt vector table");
+        return &block;
     }
 
-    void loadJobs() {
-        debugPrint("Starting to load jobs");
-        string line;
-        PCB* pcb = nullptr;
-        bool readingData = false;
-        string programCode;
+    // Build block from the page table, without touching any paging state;
+    // runBlock() checks the translations against the TLB on every entry.
+    // An operand page that is not resident cuts the block short.
+    void translateBlock(const PCB* pcb, TranslatedBlock& block) {
+        block.ops.clear();
+        block.pages.clear();
+        block.translated = true;
+        block.waitPage = -1;
+        int codePage = vaPage[block.startVA];
+        const PageTableEntry& code = pcb->pageTable[codePage];
+        block.pages.push_back({codePage, code.frame, 0, false, nullptr});
+        core->blocks.translations++;
 
-        while (getline(inFile, line)) {
-            debugPrint("Read line: " + line);
-            
-            if (line.find("$AMJ") == 0) {
-                debugPrint("Found new job");
-                pcb = new PCB();
-                pcb->pid = stoi(line.substr(4, 4));
-                pcb->TTL = stoi(line.substr(8, 4));
-                pcb->TLL = stoi(line.substr(12, 4));
-                pcb->context.state = READY;
-                pcb->context.programCounter = -1; // Means "not set yet"
-
-                programCode.clear();
-                
-                // Initialize page table
-                for (int i = 0; i < FRAME_COUNT; i++) {
-                    pcb->pageTable[i] = {-1, false};
-                }
-                
-                // Allocate frame for page table
-                int frame = allocateFrame();
-                if (frame == -1) {
-                    debugPrint("Failed to allocate frame for page table");
-                    delete pcb;
-                    throw runtime_error("Memory allocation failed for page table");
-                }
-                pcb->PTR = frame * PAGE_SIZE;
-                debugPrint("Allocated frame " + to_string(frame) + " for page table");
+        int va = block.startVA;
+        while (va < VIRTUAL_MEM_SIZE && vaPage[va] == codePage) {
+            int fetchAddr = code.frame * mem.pageSize + vaOffset[va];
+            const DecodedInstr& instr = mem.fetchDecoded(fetchAddr);
+            if (instr.op < OP_LR || instr.op > OP_BT || instr.operand < 0 || instr.operand >= VIRTUAL_MEM_SIZE) break;
+            int page = vaPage[instr.operand];
+            const PageTableEntry& target = pcb->pageTable[page];
+            if (!target.valid) {
+                block.waitPage = page;
+                break;
             }
-            else if (line.find("$DTA") == 0) {
-                debugPrint("Found data section");
-                readingData = true;
-                
-                // Load program code into memory
-                if (!programCode.empty() && pcb) {
-                    loadProgramIntoMemory(pcb, programCode);
-                }
+
+            int index = (int)block.ops.size();
+            block.ops.push_back({instr.op, target.frame * mem.pageSize + vaOffset[instr.operand], instr.operand});
+            block.lastFetch = fetchAddr;
+            block.pages[0].lastOp = index;
+            auto it = find_if(block.pages.begin(), block.pages.end(),
+                              [page](const TranslatedBlock::Page& p) { return p.page == page; });
+            if (it == block.pages.end()) {
+                block.pages.push_back({page, target.frame, index, false, nullptr});
+                it = block.pages.end() - 1;
             }
-            else if (line.find("$END") == 0) {
-                debugPrint("End of job");
-                readingData = false;
-                if (pcb) {
-                    readyQueue.push(pcb);
-                    debugPrint("Added job " + to_string(pcb->pid) + " to ready queue");
+            it->lastOp = index;
+            if (instr.op == OP_SR) it->written = true;
+            va++;
+            // A BT ends the block, and so does an SR that may rewrite it
+            if (instr.op == OP_BT || (instr.op == OP_SR && page == codePage)) break;
+        }
+        block.endVA = va;
+    }
+
+    // Put the running process back on this CPU's run queue and pick again
+    void preempt(bool expired) {
+        saveContext();
+        core->runQueue->push(core->currentPCB, expired);
+        workAvailable.notify_one();
+        pickNext();
+    }
+
+    // Leave the CPU empty: picking the same process again right away would
+    // keep its frames pinned. cpuLoop() decides when to pick again. No
+    // wakeup here, a sleeping CPU woken for this process would only fault
+    // on the same frames.
+    void yieldCPU() {
+        saveContext();
+        core->runQueue->push(core->currentPCB, false);
+        core->currentPCB = nullptr;
+    }
+
+    // Take the next process from this CPU's run queue, or steal one from the
+    // CPU with the longest queue. A process gets a fresh quantum and its
+    // saved context; false when there is nothing to run.
+    bool pickNext() {
+        Scheduler* source = core->runQueue.get();
+        if (source->empty()) {
+            source = nullptr;
+            size_t longest = 0;
+            for (Processor& other : processors) {
+                if (other.runQueue->size() > longest) {
+                    longest = other.runQueue->size();
+                    source = other.runQueue.get();
                 }
-                pcb = nullptr;
-            }
-            else if (readingData && pcb) {
-                pcb->dataCards.push_back(line);
-                debugPrint("Added data card: " + line);
             }
-            else if (pcb) {
-                programCode += line + "\n";
+            if (!source) {
+                core->currentPCB = nullptr;
+                return false;
             }
+            core->steals++;
+            core->currentPCB = source->steal(globalTimer);
+        } else {
+            core->currentPCB = source->pop(globalTimer);
         }
-        debugPrint("Finished loading jobs");
+        core->sliceUsed = 0;
+        core->timerLeft = core->timerSet = 0;
+        core->currentPCB->perf.v[PERF_DISPATCHES]++;
+        // Another CPU may have evicted this process's pages since it last
+        // ran here, so its old translations can't be trusted
+        if (processors.size() > 1) core->tlb.flushProcess(core->currentPCB->deckSeq);
+        restoreContext();
+        armTimer();
+        return true;
     }
 
-    void loadProgramIntoMemory(PCB* pcb, const string& code) {
-        debugPrint("Loading program into memory for PID " + to_string(pcb->pid));
-        
-        // Split code into instructions
-        vector<string> instructions;
-        stringstream ss(code);
-        string instruction;
-        while (getline(ss, instruction)) {
-            // Remove whitespace and newlines
-            instruction.erase(remove_if(instruction.begin(), instruction.end(), ::isspace), instruction.end());
-            if (!instruction.empty()) {
-                instructions.push_back(instruction);
+    Processor& leastLoadedCPU() {
+        Processor* best = &processors[0];
+        size_t bestLoad = SIZE_MAX;
+        for (Processor& p : processors) {
+            size_t load = p.runQueue->size() + (p.currentPCB ? 1 : 0);
+            if (load < bestLoad) {
+                bestLoad = load;
+                best = &p;
             }
         }
-        
-        debugPrint("Number of instructions: " + to_string(instructions.size()));
-        
-        // Calculate number of pages needed
-        int instructionsPerPage = PAGE_SIZE / WORD_SIZE;
-        int pagesNeeded = (instructions.size() + instructionsPerPage - 1) / instructionsPerPage;
-        debugPrint("Instructions per page: " + to_string(instructionsPerPage) + 
-                  ", Pages needed: " + to_string(pagesNeeded));
+        return *best;
+    }
 
-        // Initialize all page table entries as invalid
-        for (int i = 0; i < FRAME_COUNT; i++) {
-            pcb->pageTable[i] = {-1, false};
+    // No process is running, waiting on any CPU or blocked on I/O
+    bool systemIdle() const {
+        for (const Processor& p : processors) {
+            if (p.currentPCB || !p.runQueue->empty()) return false;
         }
+        return !channelsBusy();
+    }
 
-        // Allocate frames for program
-        for (int i = 0; i < pagesNeeded && i < FRAME_COUNT; i++) {
-            int frame = allocateFrame();
-            if (frame == -1) {
-                debugPrint("Failed to allocate frame for program page " + to_string(i));
-                throw runtime_error("Memory allocation failed for program");
-            }
-            
-            pcb->pageTable[i] = {frame, true};
-            debugPrint("Allocated frame " + to_string(frame) + " for page " + to_string(i));
+    void stopSystem() {
+        systemRunning = false;
+        workAvailable.notify_all();
+    }
 
-            // Clear frame before use
-            for (int j = 0; j < PAGE_SIZE; j++) {
-                for (int k = 0; k < WORD_SIZE; k++) {
-                    mem.data[frame * PAGE_SIZE + j][k] = '\0';
+    // Dispatch loop of one CPU. An idle CPU sleeps until a run queue gets
+    // work or the system stops. When no CPU is running but transfers are
+    // in flight, the timer skips ahead to the next I/O completion.
+    void cpuLoop() {
+        unique_lock<mutex> kernel(kernelLock);
+        // A restored checkpoint was taken mid-job; carry on from that point
+        if (core->currentPCB) executeJob(kernel);
+        while (systemRunning && globalTimer < config.timerLimit) {
+            if (!core->currentPCB) {
+                admitJobs();
+                // After a yield, let the CPUs or channels holding the frames
+                // release them first
+                bool yielded = core->yieldRequested;
+                core->yieldRequested = false;
+                if (yielded && otherCPUsRunning()) {
+                    workAvailable.wait(kernel);
+                    continue;
                 }
-            }
-
-            // Copy instructions to frame
-            int startInstr = i * instructionsPerPage;
-            int endInstr = min(startInstr + instructionsPerPage, (int)instructions.size());
-            
-            for (int j = startInstr; j < endInstr; j++) {
-                string instr = instructions[j];
-                // Pad instruction to WORD_SIZE
-                instr.resize(WORD_SIZE, ' ');
-                
-                int offset = (j - startInstr);
-                int addr = frame * PAGE_SIZE + offset;
-                
-                for (int k = 0; k < WORD_SIZE; k++) {
-                    mem.data[addr][k] = instr[k];
+                if (yielded && idleUntilTransfer()) continue;
+                if (pickNext()) {
+                    MOS_LOG(LOG_INFO, "Starting execution of process " + to_string(core->currentPCB->pid));
+                } else if (systemIdle()) {
+                    MOS_LOG(LOG_INFO, "No more processes to execute");
+                    stopSystem();
+                    break;
+                } else if (!otherCPUsRunning() && idleUntilTransfer()) {
+                    continue;
+                } else {
+                    workAvailable.wait(kernel);
+                    continue;
                 }
-                debugPrint("Loaded instruction: [" + instr + "] at frame " + to_string(frame) + 
-                          " address " + to_string(addr));
             }
+
+            MOS_LOG(LOG_INFO, "🕑 GLOBAL TIMER => [" + to_string(globalTimer) + "] Processing PID: " +
+                    to_string(core->currentPCB->pid) + " State: " + to_string(core->currentPCB->state()));
+            executeJob(kernel);
         }
+        // Idle CPUs must see the timer limit too
+        workAvailable.notify_all();
     }
 
-    void executeJob() {
-        if (!currentPCB || currentPCB->terminated) {
-            return;
-        }
+    void executeInstruction(const DecodedInstr& instr) {
+        MOS_LOG(LOG_TRACE, "Executing instruction: [" + string(core->cpu.IR, WORD_SIZE) + "]");
 
-        debugPrint("Executing job PID " + to_string(currentPCB->pid));
-        currentPCB->context.state = RUNNING;
-        
-        try {
-            while (!currentPCB->terminated && currentPCB->TTC < currentPCB->TTL) {
-                if (currentPCB->TTC >= currentPCB->TTL) {
-                    debugPrint("Time limit exceeded");
-                    terminate(EM_TIME_LIMIT);
+        switch (instr.op) {
+            case OP_GD:
+                if (instr.operand < 0) {
+                    MOS_LOG(LOG_ERROR, "Invalid operand for GD");
+                    core->cpu.PI = PI_OPERAND_ERR;
                     return;
                 }
-
-                // Map virtual address (IC) to real address
-                int realAddr;
-                if (!addressMap(cpu.IC, realAddr)) {
-                    debugPrint("Failed to map instruction address");
+                if (!addressMap(instr.operand, core->cpu.RA, ACCESS_WRITE)) {
+                    MOS_LOG(LOG_TRACE, "Address mapping failed for GD instruction");
                     return;
                 }
-                
-                // Fetch instruction
-                string instruction;
-                for (int i = 0; i < WORD_SIZE; i++) {
-                    char c = mem.data[realAddr][i];
-                    if (c != '\0') {
-                        instruction += c;
-                    }
+                core->cpu.SI = READ;
+                break;
+
+            case OP_PD:
+                if (instr.operand < 0) {
+                    MOS_LOG(LOG_ERROR, "Invalid operand for PD");
+                    core->cpu.PI = PI_OPERAND_ERR;
+                    return;
                 }
-                
-                if (instruction.empty()) {
-                    debugPrint("Empty instruction at address " + to_string(realAddr));
+                if (!addressMap(instr.operand, core->cpu.RA)) {
+                    MOS_LOG(LOG_TRACE, "Address mapping failed for PD instruction");
                     return;
                 }
+                core->cpu.SI = WRITE;
+                break;
+
+            case OP_H:
+                MOS_LOG(LOG_TRACE, "Executing H instruction");
+                core->cpu.SI = TERM;
+                break;
 
-                debugPrint("Fetched instruction: [" + instruction + "] from address " + to_string(realAddr));
-                
-                // Copy instruction to IR
-                instruction.resize(WORD_SIZE, ' ');
-                for (int i = 0; i < WORD_SIZE; i++) {
-                    cpu.IR[i] = instruction[i];
+            case OP_LR:
+            case OP_SR:
+            case OP_CR:
+            case OP_BT:
+            case OP_AD:
+            case OP_SB:
+            case OP_CL:
+            case OP_BU:
+                if (instr.operand < 0) {
+                    MOS_LOG(LOG_ERROR, "Invalid operand");
+                    core->cpu.PI = PI_OPERAND_ERR;
+                    return;
                 }
-                
-                cpu.IC++;  // Increment instruction counter
-
-                // Execute the instruction
-                executeInstruction();
-                
-                // Update timers
-                currentPCB->TTC++;
-                globalTimer++;
-
-                // Handle interrupts
-                if (cpu.SI || cpu.PI || cpu.TI) {
-                    handleInterrupt();
-                    if (!currentPCB || currentPCB->terminated) {
-                        return;
-                    }
+                executeArithmeticLogic(instr.op, instr.operand);
+                break;
+
+            case OP_MV:
+                if (instr.operand < 0) {
+                    MOS_LOG(LOG_ERROR, "Invalid operand for MV");
+                    core->cpu.PI = PI_OPERAND_ERR;
+                    return;
                 }
+                executeBlockMove(instr.operand);
+                break;
 
-                // Context switch if time slice expired
-                if (globalTimer % 10 == 0 && !readyQueue.empty()) {
-                    debugPrint("Time slice expired, switching process");
-                    saveContext();
-                    readyQueue.push(currentPCB);
-                    currentPCB = readyQueue.front();
-                    readyQueue.pop();
-                    restoreContext();
+            default:
+                MOS_LOG(LOG_ERROR, "Invalid operation code: " + string(core->cpu.IR, 2));
+                core->cpu.PI = PI_OP_ERR;
+                break;
+        }
+    }
+
+    void executeArithmeticLogic(OpCode op, int target) {
+        int realAddr;
+        if (!addressMap(target, realAddr, op == OP_SR ? ACCESS_WRITE : ACCESS_READ)) {
+            MOS_LOG(LOG_TRACE, "Address mapping failed for instruction at IC " + to_string(core->cpu.IC - 1));
+            return;
+        }
+
+        switch (op) {
+            case OP_LR:
+                copyWord(core->cpu.R, mem.data[realAddr]);
+                break;
+            case OP_SR:
+                mem.writeWord(realAddr, core->cpu.R);
+                break;
+            case OP_CR:
+                core->cpu.C = sameWord(core->cpu.R, mem.data[realAddr]);
+                break;
+            case OP_BT:
+                if (core->cpu.C) core->cpu.IC = target;
+                break;
+            case OP_BU:
+                core->cpu.IC = target;
+                break;
+            case OP_AD:
+            case OP_SB:
+            case OP_CL: {
+                int left, right;
+                if (!wordValue(core->cpu.R, left) || !wordValue(mem.data[realAddr], right)) {
+                    MOS_LOG(LOG_ERROR, string("Non-numeric word for ") + opCodeName(op));
+                    core->cpu.PI = PI_OPERAND_ERR;
+                    break;
                 }
+                if (op == OP_CL) {
+                    core->cpu.C = left < right;
+                } else if (!setWordValue(core->cpu.R, op == OP_AD ? left + right : left - right)) {
+                    MOS_LOG(LOG_ERROR, string(opCodeName(op)) + " result out of range");
+                    core->cpu.PI = PI_OPERAND_ERR;
+                }
+                break;
             }
-        }
-        catch (const exception& e) {
-            // debugPrint("Error executing process: " + string(e.what()));
-            // terminate(EM_OP_CODE_ERR);
+            default:
+                break;
         }
     }
 
-    void executeInstruction() {
-        string instruction(cpu.IR, WORD_SIZE);
-        debugPrint("Executing instruction: [" + instruction + "]");
-        
-        // Remove any trailing whitespace or null characters
-        instruction.erase(find_if(instruction.rbegin(), instruction.rend(), 
-                                [](char c) { return c != ' ' && c != '\0'; }).base(), 
-                        instruction.end());
-        
-        if (instruction.length() < 3) {
-            debugPrint("Invalid instruction length: " + to_string(instruction.length()));
-            cpu.PI = PI_OP_ERR;
-            terminate(EM_OP_CODE_ERR);
+    // MV xx: copy a range of pages, starting with the page holding the
+    // address in R, over the pages starting with the one holding xx, one
+    // frame copy per page. R's hundreds give the page count, 0 meaning 1:
+    // 0020 moves the page holding 20, 0320 three pages from there. Only one
+    // source and one target page need to be resident at a time: a fault
+    // restarts the move at the page it stopped on, which cpu.moved keeps,
+    // as a string instruction keeps its count in a register. So a move
+    // needs four frames with the page table and code page, whatever its
+    // length or the other jobs resident. Overlapping ranges copy as memmove
+    // does.
+    void executeBlockMove(int target) {
+        int value;
+        if (!wordValue(core->cpu.R, value) || value < 0) {
+            MOS_LOG(LOG_ERROR, "MV source is not an address");
+            core->cpu.PI = PI_OPERAND_ERR;
             return;
         }
-    
-        string op = instruction.substr(0, 2);
-        string operandStr = instruction.substr(2);
-        
-        // Remove any whitespace
-        op.erase(remove_if(op.begin(), op.end(), ::isspace), op.end());
-        operandStr.erase(remove_if(operandStr.begin(), operandStr.end(), ::isspace), operandStr.end());
-        
-        debugPrint("Parsed op: [" + op + "] operand: [" + operandStr + "]");
-        
-        if (op == "GD") {
-            int target;
-            try {
-                target = stoi(operandStr);
-            } catch (const exception& e) {
-                debugPrint("Invalid operand: " + operandStr);
-                cpu.PI = PI_OPERAND_ERR;
-                return;
-            }
-            
-            // Map virtual address first
-            // if (!addressMap(target, cpu.RA)) {
-            //     debugPrint("Address mapping failed for GD instruction");
-            //     return; // Error already set in addressMap()
-            // }
-            
-            cpu.SI = READ;
-            handleRead();
-            handleTerminate();
+        int source = value % VIRTUAL_MEM_SIZE;
+        int pages = max(1, value / VIRTUAL_MEM_SIZE);
+        int sourcePage = source / mem.pageSize;
+        int targetPage = target / mem.pageSize;
+        if (max(sourcePage, targetPage) + pages > mem.pagesPerProcess()) {
+            MOS_LOG(LOG_ERROR, "MV range runs past the address space");
+            core->cpu.PI = PI_OPERAND_ERR;
+            return;
         }
-        else if (op == "PD") {
-            int target;
-            try {
-                target = stoi(operandStr);
-            } catch (const exception& e) {
-                debugPrint("Invalid operand: " + operandStr);
-                cpu.PI = PI_OPERAND_ERR;
-                return;
-            }
-    
-            if (!addressMap(target, cpu.RA)) {
-                debugPrint("Address mapping failed for PD instruction");
+        if (mem.frameCount < 4) {
+            MOS_LOG(LOG_ERROR, "MV needs four frames");
+            core->cpu.PI = PI_OPERAND_ERR;
+            return;
+        }
+
+        bool backwards = targetPage > sourcePage;
+        for (int& n = core->cpu.moved; n < pages; n++) {
+            int i = backwards ? pages - 1 - n : n;
+            int sourceAddr, targetAddr;
+            if (!addressMap((sourcePage + i) * mem.pageSize, sourceAddr, ACCESS_READ) ||
+                !addressMap((targetPage + i) * mem.pageSize, targetAddr, ACCESS_WRITE)) {
+                MOS_LOG(LOG_TRACE, "Address mapping failed for MV at IC " + to_string(core->cpu.IC - 1));
                 return;
             }
-            cpu.SI = WRITE;
-            handleWrite();
+            int from = sourceAddr / mem.pageSize;
+            int to = targetAddr / mem.pageSize;
+            if (from != to) mem.loadFrame(to, mem.data[from * mem.pageSize]);
         }
-        else if (op == "H") {
-            debugPrint("Executing H instruction");
-            cpu.SI = TERM;
-            handleInterrupt();
+        core->cpu.moved = 0;
+    }
+
+    void run() {
+        MOS_LOG(LOG_INFO, "Starting input spooler");
+        size_t deckStart = config.restorePath.empty() ? 0 : restoreCheckpoint();
+        spooler.reset(new InputSpooler(input, &inputMap, config.backgroundSpooling, config.spoolCapacity, deckStart));
+        startPrinter();
+        if (!config.checkpointPath.empty()) {
+            // Fail now rather than at the first checkpoint, possibly hours in
+            string temp = config.checkpointPath + ".tmp";
+            if (!ofstream(temp, ios::binary)) throw runtime_error("Failed to write checkpoint: " + temp);
+            remove(temp.c_str());
+            nextCheckpoint = config.checkpointInterval ? (globalTimer / config.checkpointInterval + 1) * config.checkpointInterval
+                                                       : numeric_limits<long long>::max();
+            checkpointRequestsSeen = checkpointRequests;
+            signal(SIGUSR2, requestCheckpoint);
         }
-        else if (op == "LR" || op == "SR" || op == "CR" || op == "BT") {
-            debugPrint("Executing arithmetic/logic instruction: " + op);
-            int target;
-            try {
-                target = stoi(operandStr);
-            } catch (const exception& e) {
-                debugPrint("Invalid operand: " + operandStr);
-                cpu.PI = PI_OPERAND_ERR;
-                return;
+        openPerf();
+        openTrace();
+        
+        if (processors.size() == 1) {
+            core = &processors[0];
+            cpuLoop();
+        } else {
+            exception_ptr failure;
+            vector<thread> threads;
+            for (Processor& p : processors) {
+                threads.emplace_back([this, &p, &failure] {
+                    core = &p;
+                    try {
+                        cpuLoop();
+                    } catch (...) {
+                        lock_guard<mutex> kernel(kernelLock);
+                        if (!failure) failure = current_exception();
+                        stopSystem();
+                    }
+                });
             }
-            executeArithmeticLogic(op, target);
+            for (thread& t : threads) t.join();
+            if (failure) rethrow_exception(failure);
+        }
+
+        if (globalTimer >= config.timerLimit) {
+            cout << "System halted: Maximum time limit reached" << endl;
         }
-        else {
-            debugPrint("Invalid operation code: " + op);
-            cpu.PI = PI_OP_ERR;
-            terminate(EM_OP_CODE_ERR);
+        stopPrinter();
+        closePerf();
+        reportReplay();
+
+        MOS_LOG(LOG_INFO, string("Paging (") + replacementName(config.replacement) + "): faults " +
+                to_string(pagingStats.faults) + ", evictions " + to_string(pagingStats.evictions) +
+                ", swap-outs " + to_string(pagingStats.swapOuts) + ", swap-ins " + to_string(pagingStats.swapIns) +
+                ", peak frames " + to_string(pagingStats.peakFrames));
+        if (config.sharePages) {
+            MOS_LOG(LOG_INFO, "Page sharing: " + to_string(pagingStats.sharedMappings) + " shared mappings, " +
+                    to_string(pagingStats.cowCopies) + " copy-on-write copies");
         }
 
-        
-    }
+        const SchedulingStats& s = schedulingStats;
+        MOS_LOG(LOG_INFO, string("Scheduling (") + schedulingName(config.scheduling) + ", admit " +
+                admissionName(config.admission) + ", quantum " +
+                to_string(config.quantum) + "): " + to_string(s.jobs) + " jobs, throughput " +
+                to_string(globalTimer ? 1000.0 * s.jobs / globalTimer : 0.0) + " jobs/1000 ticks, avg turnaround " +
+                to_string(s.jobs ? double(s.turnaround) / s.jobs : 0.0) + ", avg waiting " +
+                to_string(s.jobs ? double(s.waiting) / s.jobs : 0.0) +
+                (s.rejected ? ", " + to_string(s.rejected) + " rejected" : string()));
 
-    void executeArithmeticLogic(const string& op, int target) {
-        int realAddr;
-        if (!addressMap(target, realAddr)) {
-            debugPrint("Address mapping failed for " + op + " instruction");
-            return;
+        const HardwareISR& io = hardwareISR;
+        MOS_LOG(LOG_INFO, string("I/O (") + (config.asyncIO ? "async" : "sync") + ", latency " +
+                to_string(config.ioLatency) + "): disk " + to_string(io.diskChannel.requests) + " requests, printer " +
+                to_string(io.printerChannel.requests) + " requests, CPU utilization " +
+                to_string(100.0 * cpuUtilization()) + "%");
+
+        long long hits = tlbHits(), lookups = hits + tlbMisses();
+        MOS_LOG(LOG_INFO, "TLB hits: " + to_string(hits) + ", misses: " + to_string(tlbMisses()) +
+                ", hit rate: " + to_string(lookups ? 100.0 * hits / lookups : 0.0) + "%");
+        long long translations = 0, blockRuns = 0;
+        for (const Processor& p : processors) {
+            translations += p.blocks.translations;
+            blockRuns += p.blocks.runs;
+        }
+        MOS_LOG(LOG_INFO, "Translation cache: " + to_string(translations) + " blocks translated, " +
+                to_string(blockRuns) + " block runs");
+        if (processors.size() > 1) {
+            for (const Processor& p : processors) {
+                MOS_LOG(LOG_INFO, "CPU " + to_string(p.id) + ": " + to_string(p.instructions) +
+                        " instructions, " + to_string(p.steals) + " steals");
+            }
         }
+    }
+
+    const PagingStats& pagingStatistics() const { return pagingStats; }
+    // Totals of every job folded so far; complete once run() returns
+    const PerfCounters& perfCounters() const { return perfTotals; }
+    const SchedulingStats& schedulingStatistics() const { return schedulingStats; }
+    long long tlbHits() const {
+        long long total = 0;
+        for (const Processor& p : processors) total += p.tlb.hits;
+        return total;
+    }
+    long long tlbMisses() const {
+        long long total = 0;
+        for (const Processor& p : processors) total += p.tlb.misses;
+        return total;
+    }
+    long long instructionCount() const {
+        long long total = 0;
+        for (const Processor& p : processors) total += p.instructions;
+        return total;
+    }
+    long long ticks() const { return globalTimer; }
+    // Share of the ticks spent executing instructions rather than waiting on I/O
+    double cpuUtilization() const {
+        return globalTimer ? double(instructionCount()) / globalTimer : 0.0;
+    }
+    const vector<JobRecord>& completedJobs() const { return jobRecords; }
+};
 
-        if (op == "LR") {
-            copy(mem.data[realAddr], mem.data[realAddr]+WORD_SIZE, cpu.R);
+thread_local Processor* MOS::core = nullptr;
+
+const MOS::InterruptHandler MOS::interruptVectorTable[IRQ_COUNT] = {
+    &MOS::handleRead,            // IRQ_SI_READ
+    &MOS::handleWrite,           // IRQ_SI_WRITE
+    &MOS::handleTerminate,       // IRQ_SI_TERM
+    &MOS::handleOpCodeError,     // IRQ_PI_OP_ERR
+    &MOS::handleOperandError,    // IRQ_PI_OPERAND_ERR
+    &MOS::handlePageFault,       // IRQ_PI_PAGE_FAULT
+    &MOS::handleTimerInterrupt,  // IRQ_TIMER
+};
+
+// Synthetic deck shape for --bench. Each job reads a "CONT" card, runs a
+// body of LR/CR instructions with PD lines mixed in, and branches back with
+// BT. The "STOP" card ends the loop. Long jobs loop BENCH_LONG_FACTOR times
+// as often, and faulty jobs get one defect from the error table.
+struct BenchOptions {
+    int jobs = 1000;
+    int bodyLength = 20;   // LR/CR/PD instructions per loop iteration
+    int iterations = 20;   // CONT cards per job
+    int writes = 1;        // PD instructions per iteration (GD is always 1)
+    int faultPercent = 0;  // share of jobs with an injected error
+    int longPercent = 0;   // share of long compute jobs among short ones
+    int runs = 1;
+    unsigned seed = 1;
+};
+
+const int BENCH_CONST_ADDR = 79;   // "CONT" constant, last word of page 7
+const int BENCH_CARD_ADDR = 90;    // GD/PD buffer
+const int BENCH_MAX_BODY = 70;     // the body must end before BENCH_CONST_ADDR
+const int BENCH_LONG_FACTOR = 10;
+
+// Limits a fault-free job just fits in; both must fit the 4-digit $AMJ fields
+long long benchTimeLimit(const BenchOptions& opts, int iterations) {
+    return (long long)iterations * (opts.bodyLength + 7) + 8;
+}
+
+long long benchLineLimit(const BenchOptions& opts, int iterations) {
+    return (long long)iterations * opts.writes + 1;
+}
+
+int benchMaxIterations(const BenchOptions& opts) {
+    return opts.longPercent ? opts.iterations * BENCH_LONG_FACTOR : opts.iterations;
+}
+
+string benchOperand(int addr) {
+    return string(1, char('0' + addr / 10)) + char('0' + addr % 10);
+}
+
+void generateBenchDeck(const BenchOptions& opts, ostream& out) {
+    mt19937 rng(opts.seed);
+    uniform_int_distribution<int> percent(0, 99);
+    const string constant = benchOperand(BENCH_CONST_ADDR);
+    const string card = benchOperand(BENCH_CARD_ADDR);
+
+    for (int j = 0; j < opts.jobs; j++) {
+        // Loop head: 00 GD 01 LR 02 CR 03 BT body 04 H
+        vector<string> code = {"GD" + card, "LR" + card, "CR" + constant, "BT05", "H"};
+        for (int i = 0; i < opts.bodyLength; i++) {
+            bool write = i * opts.writes / opts.bodyLength != (i + 1) * opts.writes / opts.bodyLength;
+            if (write) code.push_back("PD" + card);
+            else code.push_back((i % 2 ? "CR" : "LR") + constant);
         }
-        else if (op == "SR") {
-            copy(cpu.R, cpu.R+WORD_SIZE, mem.data[realAddr]);
+        // Unconditional branch back: R == CONT after the reload
+        code.push_back("LR" + constant);
+        code.push_back("CR" + constant);
+        code.push_back("BT00");
+        code.resize(BENCH_CONST_ADDR, "H");
+        code.push_back("CONT");
+
+        int iterations = percent(rng) < opts.longPercent ? opts.iterations * BENCH_LONG_FACTOR : opts.iterations;
+        long long ttl = benchTimeLimit(opts, iterations);
+        long long tll = benchLineLimit(opts, iterations);
+        bool stopCard = true;
+
+        if (percent(rng) < opts.faultPercent) {
+            int at = 5 + (opts.bodyLength ? (int)(rng() % opts.bodyLength) : 0);
+            switch (rng() % 6) {
+                case 0: code[at] = "XX" + card; break;          // invalid opcode
+                case 1: code[at] = "LRAB"; break;               // invalid operand
+                case 2: code[at] = "LR85"; break;               // read of a page never written
+                case 3: ttl /= 2; break;                        // time limit
+                case 4: tll = tll / 2 + (opts.writes == 0); break; // line limit when the job prints
+                case 5: stopCard = false; break;                // runs out of data
+            }
         }
-        else if (op == "CR") {
-            cpu.C = equal(cpu.R, cpu.R+WORD_SIZE, mem.data[realAddr]);
+
+        char header[64];
+        snprintf(header, sizeof(header), "$AMJ%04d%04lld%04lld%d", j % 9999 + 1, ttl, tll, (int)(rng() % 10));
+        out << header << "\n";
+        for (const string& word : code) out << word << "\n";
+        out << "$DTA\n";
+        for (int c = 0; c < iterations; c++) out << "CONT card " << c << "\n";
+        if (stopCard) out << "STOP\n";
+        out << "$END\n";
+    }
+}
+
+double percentile(vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    // Nearest rank
+    size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+    return sorted[min(max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+// Generate a deck, run the MOS on it headless and print throughput
+// and turnaround percentiles for each run
+int runBenchmark(const BenchOptions& opts, MOSConfig config) {
+    const string deckPath = "bench_input.txt";
+    const string outputPath = "bench_output.txt";
+    {
+        ofstream deck(deckPath);
+        if (!deck) throw runtime_error("Cannot create " + deckPath);
+        generateBenchDeck(opts, deck);
+    }
+    config.recordJobs = true;
+    config.timerLimit = numeric_limits<long long>::max();
+
+    cout << "Benchmark: " << opts.jobs << " jobs, body " << opts.bodyLength << ", " << opts.iterations
+         << " iterations, " << opts.writes << " PD/iteration, " << opts.faultPercent << "% faulty, "
+         << opts.longPercent << "% long, " << config.geometry.frameCount << " frames, "
+         << replacementName(config.replacement) << ", " << schedulingName(config.scheduling)
+         << " quantum " << config.quantum << ", " << (config.asyncIO ? "async" : "sync") << " I/O latency "
+         << config.ioLatency << endl;
+
+    for (int run = 1; run <= opts.runs; run++) {
+        auto start = chrono::steady_clock::now();
+        MOS mos(deckPath, outputPath, config);
+        mos.run();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        const vector<JobRecord>& records = mos.completedJobs();
+        vector<double> wall, ticks;
+        int failed = 0;
+        for (const JobRecord& r : records) {
+            wall.push_back(r.turnaroundMicros);
+            ticks.push_back(double(r.finishTick - r.admitTick));
+            if (r.code != EM_NO_ERR) failed++;
         }
-        else if (op == "BT" && cpu.C) {
-            cpu.IC = target;
+        sort(wall.begin(), wall.end());
+        sort(ticks.begin(), ticks.end());
+
+        double seconds = max(elapsed.count(), 1e-9);
+        cout << fixed << setprecision(3)
+             << "run " << run << ": " << seconds * 1000 << " ms, "
+             << mos.instructionCount() / seconds / 1e6 << " M instr/s, "
+             << records.size() / seconds << " jobs/s (" << records.size() << " jobs, " << failed << " abnormal)\n"
+             << "  turnaround us  p50 " << percentile(wall, 50) << "  p90 " << percentile(wall, 90)
+             << "  p99 " << percentile(wall, 99) << "  max " << (wall.empty() ? 0.0 : wall.back()) << "\n"
+             << setprecision(0)
+             << "  turnaround ticks  p50 " << percentile(ticks, 50) << "  p90 " << percentile(ticks, 90)
+             << "  p99 " << percentile(ticks, 99) << "  max " << (ticks.empty() ? 0.0 : ticks.back()) << "\n";
+
+        const MOS::SchedulingStats& sched = mos.schedulingStatistics();
+        long long jobs = max(sched.jobs, 1LL);
+        cout << setprecision(1) << "  scheduling  throughput " << 1000.0 * sched.jobs / max(mos.ticks(), 1LL)
+             << " jobs/1000 ticks  avg turnaround " << double(sched.turnaround) / jobs
+             << "  avg waiting " << double(sched.waiting) / jobs
+             << (sched.rejected ? "  rejected " + to_string(sched.rejected) : string())
+             << "  cpu utilization " << 100.0 * mos.cpuUtilization() << "%" << endl;
+    }
+    return 0;
+}
+
+// Turn off what reads or writes one fixed file, which MOS instances
+// sharing a process would fight over
+void detachFromFiles(MOSConfig& config) {
+    config.perfFormat = PERF_OFF;
+    config.traceRecords = 0;
+    config.replayPath.clear();
+    config.checkpointPath.clear();
+    config.restorePath.clear();
+}
+
+// Parallel batch engine. Jobs share nothing, so the deck is cut into
+// shards of consecutive jobs. A thread pool runs each shard in its own
+// MOS with in-memory streams. Shards print in deck order and their outputs
+// are joined in shard order, so the result matches a deck-order run of
+// the whole deck in one MOS. Termination order depends on the cut, so it
+// is not offered.
+void runSharded(const string& inputPath, const string& outputPath, MOSConfig config,
+                int shardCount, int threadCount) {
+    ifstream in(inputPath);
+    if (!in) throw runtime_error("Failed to open input file: " + inputPath);
+    ofstream out(outputPath);
+    if (!out) throw runtime_error("Failed to open output file: " + outputPath);
+
+    // Split into $AMJ..$END blocks; lines outside a job are skipped, as the
+    // spooler does
+    vector<string> jobs;
+    string line;
+    bool inJob = false;
+    while (getline(in, line)) {
+        if (line.compare(0, 4, "$AMJ") == 0) {
+            jobs.emplace_back();
+            inJob = true;
         }
+        if (!inJob) continue;
+        jobs.back() += line;
+        jobs.back() += '\n';
+        if (line.compare(0, 4, "$END") == 0) inJob = false;
     }
 
-    void run() {
-        loadJobs();
-        
-        while (systemRunning && globalTimer < MAX_TIMER) {
-            if (!currentPCB) {
-                if (!readyQueue.empty()) {
-                    currentPCB = readyQueue.front();
-                    readyQueue.pop();
-                    restoreContext();
-                    debugPrint("Starting execution of process " + to_string(currentPCB->pid));
-                } else {
-                    debugPrint("No more processes to execute");
-                    systemRunning = false;
-                    break;
+    shardCount = max(1, min<int>(shardCount, jobs.size()));
+    vector<string> decks(shardCount), outputs(shardCount);
+    for (size_t j = 0; j < jobs.size(); j++) {
+        decks[j * shardCount / jobs.size()] += jobs[j];
+    }
+    jobs.clear();
+
+    config.deckOrderOutput = true;
+    detachFromFiles(config);
+    atomic<int> nextShard{0};
+    exception_ptr failure;
+    mutex failureLock;
+    auto worker = [&] {
+        for (int shard; (shard = nextShard++) < shardCount;) {
+            try {
+                istringstream deck(decks[shard]);
+                ostringstream result;
+                {
+                    MOS mos(deck, result, config);
+                    mos.run();
                 }
+                outputs[shard] = result.str();
+                decks[shard].clear();
+            } catch (...) {
+                lock_guard<mutex> lock(failureLock);
+                if (!failure) failure = current_exception();
             }
+        }
+    };
 
-            if (currentPCB) {
-                cout << "🕑 GLOBAL TIMER => [" << globalTimer << "] Processing PID: " 
-                     << currentPCB->pid << " State: " << currentPCB->context.state << endl;
-                
-                executeJob();
-                
-                // Check if current process terminated
-                if (!currentPCB || currentPCB->terminated) {
-                    continue;
-                }
+    vector<thread> pool;
+    for (int t = 0; t < min(threadCount, shardCount); t++) pool.emplace_back(worker);
+    for (thread& t : pool) t.join();
+    if (failure) rethrow_exception(failure);
+
+    for (const string& shardOutput : outputs) out << shardOutput;
+    MOS_LOG(LOG_INFO, "Ran " + to_string(shardCount) + " shards on " + to_string(pool.size()) + " threads");
+}
+
+// Service mode: one connection carries decks back to back, each closed by
+// a $EOD card. The reply to each is its output closed the same way.
+class DeckConnection {
+public:
+    DeckConnection(int in, int out) : in(in), out(out) {}
+
+    // The next deck; false once the input has closed with nothing pending
+    bool next(string& deck) {
+        deck.clear();
+        bool pending = false;
+        while (readLine()) {
+            pending = true;
+            if (line.compare(0, 4, "$EOD") == 0) return true;
+            deck += line;
+            deck += '\n';
+        }
+        return pending;
+    }
+
+    void reply(const string& text) {
+        writeAll(text.data(), text.size());
+        if (!text.empty() && text.back() != '\n') writeAll("\n", 1);
+        writeAll("$EOD\n", 5);
+    }
+
+private:
+    bool readLine() {
+        line.clear();
+        while (true) {
+            if (pos == filled) {
+                ssize_t n = ::read(in, buffer, sizeof(buffer));
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) throw runtime_error(string("Read failed: ") + strerror(errno));
+                if (n == 0) return !line.empty();
+                pos = 0;
+                filled = n;
+            }
+            const char* start = buffer + pos;
+            const char* newline = static_cast<const char*>(memchr(start, '\n', filled - pos));
+            if (newline) {
+                line.append(start, newline);
+                pos += newline - start + 1;
+                return true;
             }
+            line.append(start, filled - pos);
+            pos = filled;
         }
+    }
 
-        if (globalTimer >= MAX_TIMER) {
-            cout << "System halted: Maximum time limit reached" << endl;
+    void writeAll(const char* data, size_t size) {
+        while (size) {
+            ssize_t n = ::write(out, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw runtime_error(string("Write failed: ") + strerror(errno));
+            data += n;
+            size -= n;
         }
     }
+
+    int in, out;
+    char buffer[64 * 1024];
+    size_t pos = 0, filled = 0;
+    string line;
 };
 
-int main() {
+// Run every deck on a connection, each in a fresh MOS over the bytes
+// received. A deck that fails gets the error as its reply.
+long long serveConnection(DeckConnection& connection, const MOSConfig& config) {
+    long long served = 0;
+    string deck;
+    while (connection.next(deck)) {
+        ostringstream result;
+        try {
+            MOS mos(deck.data(), deck.size(), result, config);
+            mos.run();
+        } catch (const exception& e) {
+            result << "System error: " << e.what() << "\n";
+        }
+        connection.reply(result.str());
+        served++;
+    }
+    return served;
+}
+
+// Long-running service: decks come over stdin and replies go to stdout,
+// or, given a path, over a Unix socket there, one client at a time
+int runService(const string& socketPath, MOSConfig config) {
+    detachFromFiles(config);
+    signal(SIGPIPE, SIG_IGN);  // a client hanging up is a write error
+
+    if (socketPath.empty()) {
+        // stdout carries the replies; console messages move to stderr
+        streambuf* console = cout.rdbuf(cerr.rdbuf());
+        DeckConnection connection(STDIN_FILENO, STDOUT_FILENO);
+        long long served = serveConnection(connection, config);
+        cout.rdbuf(console);
+        MOS_LOG(LOG_INFO, "Served " + to_string(served) + " decks");
+        return 0;
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        throw runtime_error("Socket path too long: " + socketPath);
+    }
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    struct stat st;
+    if (stat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socketPath.c_str());  // left by an earlier server
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0) {
+        throw runtime_error("Cannot listen on " + socketPath + ": " + strerror(errno));
+    }
+    cout << "Serving decks on " << socketPath << endl;
+    while (true) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(string("Accept failed: ") + strerror(errno));
+        }
+        try {
+            DeckConnection connection(client, client);
+            long long served = serveConnection(connection, config);
+            MOS_LOG(LOG_INFO, "Served " + to_string(served) + " decks on a connection");
+        } catch (const exception& e) {
+            MOS_LOG(LOG_ERROR, string("Connection dropped: ") + e.what());
+        }
+        close(client);
+    }
+}
+
+// Build with -DMOS_NO_MAIN to embed the MOS in another program
+#ifndef MOS_NO_MAIN
+
+// Matches "--name=value" and returns the value part
+bool matchOption(const string& arg, const string& name, string& value) {
+    if (arg.compare(0, name.size() + 1, name + "=") != 0) return false;
+    value = arg.substr(name.size() + 1);
+    return true;
+}
+
+bool parsePositive(const string& text, int& value) {
+    if (text.empty() || !all_of(text.begin(), text.end(), ::isdigit) || text.size() > 9) return false;
+    value = stoi(text);
+    return value > 0;
+}
+
+bool parseCount(const string& text, int& value) {
+    return text == "0" ? (value = 0, true) : parsePositive(text, value);
+}
+
+void printUsage(const char* prog) {
+    cerr << "Usage: " << prog << " [--log=off|error|info|trace] [--frames=N] [--page-size=N]"
+         << " [--random-frames] [--seed=N] [--no-demand-paging] [--share-pages]"
+         << " [--replace=clock|lru|fifo|none] [--paging-report]"
+         << " [--no-background-spool] [--spool-capacity=N] [--no-mmap]"
+         << " [--async-printer] [--output-buffer=BYTES]"
+         << " [--sched=rr|priority|srt|mlfq] [--quantum=N] [--mlfq-levels=N] [--cpus=N]"
+         << " [--admit=free|working-set] [--data-pages=N]"
+         << " [--async-io] [--io-latency=TICKS] [--no-threaded-core] [--no-block-cache] [--extended-isa]" << endl;
+    cerr << "       [--perf=off|json|csv] [--perf-file=PATH] [--perf-interval=TICKS]" << endl;
+    cerr << "       [--checkpoint=PATH] [--checkpoint-interval=TICKS] [--restore=PATH]" << endl;
+    cerr << "       [--trace-ring=RECORDS] [--trace-file=PATH] [--replay-trace=PATH] [--decode-trace=PATH]" << endl;
+    cerr << "       [--input=PATH] [--output=PATH] [--output-order=termination|deck]"
+         << " [--shards=N] [--shard-threads=N] [--serve[=SOCKET]]" << endl;
+    cerr << "       (--shards prints in deck order, like --output-order=deck)" << endl;
+    cerr << "       " << prog << " --bench [--bench-jobs=N] [--bench-body=N] [--bench-iterations=N]"
+         << " [--bench-writes=N] [--bench-faults=PERCENT] [--bench-long=PERCENT] [--bench-runs=N]"
+         << " [options above]" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    MOSConfig config;
+    MemoryGeometry& geometry = config.geometry;
+    BenchOptions bench;
+    bool benchMode = false;
+    string inputPath = "input.txt";
+    string outputPath = "output.txt";
+    int shards = 0;
+    bool terminationOrder = false;
+    int shardThreads = max(1, (int)thread::hardware_concurrency());
+    bool logLevelSet = false;
+    string decodePath;
+    bool serveMode = false;
+    string servePath;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        string value;
+        bool ok = false;
+        if (matchOption(arg, "--log", value)) ok = logLevelSet = parseLogLevel(value, runtimeLogLevel);
+        else if (matchOption(arg, "--frames", value)) ok = parsePositive(value, geometry.frameCount);
+        else if (matchOption(arg, "--page-size", value)) ok = parsePositive(value, geometry.pageSize);
+        else if (arg == "--random-frames") {
+            config.placement = PLACE_RANDOM;
+            ok = true;
+        }
+        else if (matchOption(arg, "--replace", value)) ok = parseReplacement(value, config.replacement);
+        else if (arg == "--paging-report") {
+            config.pagingReport = true;
+            ok = true;
+        }
+        else if (arg == "--no-background-spool") {
+            config.backgroundSpooling = false;
+            ok = true;
+        }
+        else if (matchOption(arg, "--spool-capacity", value)) ok = parsePositive(value, config.spoolCapacity);
+        else if (arg == "--no-mmap") {
+            config.mapInput = false;
+            ok = true;
+        }
+        else if (arg == "--async-printer") {
+            config.asyncPrinter = true;
+            ok = true;
+        }
+        else if (matchOption(arg, "--output-buffer", value)) ok = parsePositive(value, config.outputBufferBytes);
+        else if (arg == "--async-io") {
+            config.asyncIO = true;
+            ok = true;
+        }
+        else if (matchOption(arg, "--io-latency", value)) ok = parseCount(value, config.ioLatency);
+        else if (arg == "--no-threaded-core") {
+            config.threadedCore = false;
+            ok = true;
+        }
+        else if (matchOption(arg, "--perf", value)) ok = parsePerfFormat(value, config.perfFormat);
+        else if (matchOption(arg, "--perf-file", value)) ok = !(config.perfPath = value).empty();
+        else if (matchOption(arg, "--perf-interval", value)) {
+            int ticks = 0;
+            ok = parsePositive(value, ticks);
+            config.perfInterval = ticks;
+        }
+        else if (matchOption(arg, "--checkpoint", value)) ok = !(config.checkpointPath = value).empty();
+        else if (matchOption(arg, "--checkpoint-interval", value)) {
+            int ticks = 0;
+            ok = parsePositive(value, ticks);
+            config.checkpointInterval = ticks;
+        }
+        else if (matchOption(arg, "--restore", value)) ok = !(config.restorePath = value).empty();
+        else if (matchOption(arg, "--trace-ring", value)) ok = parsePositive(value, config.traceRecords);
+        else if (matchOption(arg, "--trace-file", value)) ok = !(config.tracePath = value).empty();
+        else if (matchOption(arg, "--replay-trace", value)) ok = !(config.replayPath = value).empty();
+        else if (matchOption(arg, "--decode-trace", value)) ok = !(decodePath = value).empty();
+        else if (arg == "--no-block-cache") {
+            config.blockCache = false;
+            ok = true;
+        }
+        else if (arg == "--extended-isa") {
+            config.extendedISA = true;
+            ok = true;
+        }
+        else if (matchOption(arg, "--cpus", value)) ok = parsePositive(value, config.cpus) && config.cpus <= 64;
+        else if (matchOption(arg, "--sched", value)) ok = parseScheduling(value, config.scheduling);
+        else if (matchOption(arg, "--admit", value)) ok = parseAdmission(value, config.admission);
+        else if (matchOption(arg, "--data-pages", value)) ok = parseCount(value, config.dataPageEstimate);
+        else if (matchOption(arg, "--quantum", value)) ok = parsePositive(value, config.quantum);
+        else if (matchOption(arg, "--mlfq-levels", value)) {
+            ok = parsePositive(value, config.mlfqLevels) && config.mlfqLevels <= 16;
+        }
+        else if (matchOption(arg, "--input", value)) ok = !(inputPath = value).empty();
+        else if (matchOption(arg, "--output", value)) ok = !(outputPath = value).empty();
+        else if (matchOption(arg, "--output-order", value)) {
+            ok = value == "deck" || value == "termination";
+            config.deckOrderOutput = value == "deck";
+            terminationOrder = value == "termination";
+        }
+        else if (matchOption(arg, "--shards", value)) ok = parsePositive(value, shards);
+        else if (matchOption(arg, "--shard-threads", value)) ok = parsePositive(value, shardThreads);
+        else if (arg == "--serve") ok = serveMode = true;
+        else if (matchOption(arg, "--serve", value)) ok = serveMode = !(servePath = value).empty();
+        else if (arg == "--bench") {
+            benchMode = true;
+            ok = true;
+        }
+        else if (matchOption(arg, "--bench-jobs", value)) ok = parsePositive(value, bench.jobs);
+        else if (matchOption(arg, "--bench-body", value)) {
+            ok = parseCount(value, bench.bodyLength) && bench.bodyLength <= BENCH_MAX_BODY;
+        }
+        else if (matchOption(arg, "--bench-iterations", value)) ok = parsePositive(value, bench.iterations);
+        else if (matchOption(arg, "--bench-writes", value)) ok = parseCount(value, bench.writes);
+        else if (matchOption(arg, "--bench-faults", value)) {
+            ok = parseCount(value, bench.faultPercent) && bench.faultPercent <= 100;
+        }
+        else if (matchOption(arg, "--bench-long", value)) {
+            ok = parseCount(value, bench.longPercent) && bench.longPercent <= 100;
+        }
+        else if (matchOption(arg, "--bench-runs", value)) ok = parsePositive(value, bench.runs);
+        else if (arg == "--no-demand-paging") {
+            config.demandPaging = false;
+            ok = true;
+        }
+        else if (arg == "--share-pages") {
+            config.sharePages = true;
+            ok = true;
+        }
+        else if (matchOption(arg, "--seed", value)) {
+            int seed;
+            ok = parsePositive(value, seed);
+            config.seed = seed;
+            bench.seed = seed;
+        }
+        if (!ok) {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (shards > 0 && terminationOrder) {
+        cerr << "--shards always prints in deck order" << endl;
+        return 1;
+    }
+    if (benchMode && bench.writes > bench.bodyLength) {
+        cerr << "--bench-writes cannot exceed --bench-body" << endl;
+        return 1;
+    }
+    int longest = benchMaxIterations(bench);
+    if (benchMode && (benchTimeLimit(bench, longest) > 9999 || benchLineLimit(bench, longest) > 9999)) {
+        cerr << "Benchmark jobs exceed the 4-digit TTL/TLL; lower --bench-iterations or --bench-body" << endl;
+        return 1;
+    }
+
     try {
-        MOS mos("input.txt", "output.txt");
-        mos.run();
+        if (!decodePath.empty()) {
+            decodeTrace(decodePath, cout);
+            return 0;
+        }
+        if (benchMode) {
+            if (!logLevelSet) runtimeLogLevel = LOG_OFF;
+            return runBenchmark(bench, config);
+        }
+        if (serveMode) {
+            if (!logLevelSet) runtimeLogLevel = LOG_OFF;
+            return runService(servePath, config);
+        }
+        if (shards > 0) {
+            runSharded(inputPath, outputPath, config, shards, shardThreads);
+        } else {
+            MOS mos(inputPath, outputPath, config);
+            mos.run();
+        }
         cout << "System shutdown normally" << endl;
     }
     catch (const exception& e) {
@@ -962,5 +4744,4 @@ int main() {
     return 0;
 }
 
-
-
+#endif // MOS_NO_MAIN
@@ -0,0 +1,83 @@
+// Embeds the MOS through MOS_NO_MAIN and checks the jobOutput callback
+// against the output stream. Usage: embed_test DECK. Exits non-zero on a
+// mismatch, naming it on stderr.
+#define MOS_NO_MAIN
+#include "../MOS_Phase_3.cpp"
+
+#include <set>
+
+struct Part {
+    long long jobId;
+    int pid;
+    string text;
+    bool final;
+};
+
+// Run the deck in memory, collecting each callback in call order
+vector<Part> runWithCallback(const string& deck, int outputBufferBytes) {
+    vector<Part> parts;
+    MOSConfig config;
+    config.outputBufferBytes = outputBufferBytes;
+    config.jobOutput = [&parts](long long jobId, int pid, const string& text, bool final) {
+        parts.push_back(Part{jobId, pid, text, final});
+    };
+    ostringstream unused;
+    MOS mos(deck.data(), deck.size(), unused, config);
+    mos.run();
+    return parts;
+}
+
+int check(bool ok, const string& what) {
+    if (!ok) cerr << "embed_test: " << what << endl;
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        cerr << "Usage: " << argv[0] << " DECK" << endl;
+        return 2;
+    }
+    runtimeLogLevel = LOG_OFF;
+    ifstream file(argv[1]);
+    string deck((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    ostringstream printed;
+    {
+        MOS mos(deck.data(), deck.size(), printed, MOSConfig());
+        mos.run();
+    }
+
+    // Whole blocks, one per job, in the order the printer got them
+    vector<Part> whole = runWithCallback(deck, MOSConfig().outputBufferBytes);
+    string joined;
+    set<long long> ids;
+    set<int> pids;
+    for (const Part& part : whole) {
+        joined += part.text;
+        ids.insert(part.jobId);
+        pids.insert(part.pid);
+    }
+    int failures = 0;
+    failures += check(joined == printed.str(), "callback output differs from the stream");
+    failures += check(ids.size() == whole.size(), "two blocks share a jobId");
+    failures += check(pids.size() < whole.size(), "deck should repeat a pid");
+    for (const Part& part : whole) {
+        failures += check(part.final, "job " + to_string(part.jobId) + " has a partial block");
+    }
+
+    // Tiny buffers split each job into parts; stitched by jobId they match
+    map<long long, string> stitched;
+    map<long long, int> finals;
+    vector<Part> split = runWithCallback(deck, 1);
+    failures += check(split.size() > whole.size(), "a 1-byte buffer should split jobs");
+    for (const Part& part : split) {
+        failures += check(!finals[part.jobId], "job " + to_string(part.jobId) + " has a part after its last");
+        stitched[part.jobId] += part.text;
+        finals[part.jobId] += part.final;
+    }
+    for (const Part& part : whole) {
+        failures += check(stitched[part.jobId] == part.text, "job " + to_string(part.jobId) + " parts differ");
+        failures += check(finals[part.jobId] == 1, "job " + to_string(part.jobId) + " has no single last part");
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,567 @@
+#!/bin/sh
+# Regression decks: builds the simulator, runs each deck and compares the
+# output with tests/expected. Exits non-zero when any case fails.
+set -u
+cd "$(dirname "$0")/.."
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+mos="$work/mos"
+g++ -std=c++17 -O2 -Wall -Wextra -pthread -o "$mos" MOS_Phase_3.cpp || exit 1
+failures=0
+
+pass() { echo "PASS $1"; }
+fail() { echo "FAIL $1"; failures=$((failures + 1)); }
+
+# expect_output NAME DECK EXPECTED [OPTIONS]: the run succeeds and prints EXPECTED
+expect_output() {
+    name=$1 deck=$2 expected=$3
+    shift 3
+    if "$mos" --log=off --input="$deck" --output="$work/$name.txt" "$@" > /dev/null &&
+       cmp -s "$work/$name.txt" "$expected"; then
+        pass "$name"
+    else
+        fail "$name"
+    fi
+}
+
+# expect_failure NAME DECK MESSAGE [OPTIONS]: the run exits non-zero, reporting MESSAGE
+expect_failure() {
+    name=$1 deck=$2 message=$3
+    shift 3
+    if ! "$mos" --log=off --input="$deck" --output="$work/$name.txt" "$@" > /dev/null 2> "$work/$name.err" &&
+       grep -qF "$message" "$work/$name.err"; then
+        pass "$name"
+    else
+        fail "$name"
+    fi
+}
+
+expect_output sample input.txt output.txt
+
+# Memory geometry only changes how much fits at once, never what a deck prints
+for frames in 3 7 64 65 1000; do
+    expect_output sample_frames_$frames input.txt output.txt --frames=$frames
+done
+expect_output sample_random_frames input.txt output.txt --frames=200 --random-frames --seed=7
+for frames in 3 16 200; do
+    expect_output mixed_frames_$frames tests/decks/mixed_jobs.txt tests/expected/mixed_jobs_deck_order.txt \
+        --frames=$frames --output-order=deck
+done
+expect_failure page_size_legacy input.txt "needs --extended-isa" --page-size=20
+
+# Loading every program page up front still allocates data pages on a GD/SR fault
+expect_output sample_eager input.txt output.txt --no-demand-paging
+# Jobs that run to completion print the same with and without demand paging
+legacy=tests/decks/legacy_jobs.txt
+expect_output legacy_jobs $legacy tests/expected/legacy_jobs.txt
+expect_output legacy_jobs_eager $legacy tests/expected/legacy_jobs.txt --no-demand-paging
+expect_output legacy_jobs_eager_frames $legacy tests/expected/legacy_jobs.txt --no-demand-paging --frames=30
+expect_output eager_paging tests/decks/eager_paging.txt tests/expected/eager_paging.txt --no-demand-paging
+
+# Deck reader: the mapping and line-by-line reading agree on a deck with
+# no final newline, an empty deck and CRLF line ends
+printf '%s' "$(cat input.txt)" > "$work/no_newline.txt"
+: > "$work/empty_deck.txt"
+sed 's/$/\r/' input.txt > "$work/crlf.txt"
+expect_output deck_no_newline "$work/no_newline.txt" output.txt
+expect_output deck_no_newline_stream "$work/no_newline.txt" output.txt --no-mmap
+expect_output empty_deck "$work/empty_deck.txt" "$work/empty_deck.txt"
+expect_output empty_deck_stream "$work/empty_deck.txt" "$work/empty_deck.txt" --no-mmap
+if "$mos" --log=off --input="$work/crlf.txt" --output="$work/crlf_mapped.txt" > /dev/null &&
+   "$mos" --log=off --input="$work/crlf.txt" --output="$work/crlf_stream.txt" --no-mmap > /dev/null &&
+   [ "$(grep -c 'terminated' "$work/crlf_mapped.txt")" -eq 4 ] &&
+   cmp -s "$work/crlf_mapped.txt" "$work/crlf_stream.txt"; then
+    pass deck_crlf
+else
+    fail deck_crlf
+fi
+
+# Interval timer: a job that halts on its last allowed tick ends normally,
+# and one allowed a tick less runs out of time, whatever the quantum or
+# the CPU core. Time blocked on a transfer is not charged to the job, and
+# with every CPU idle the timer skips straight to the next completion.
+timed=tests/decks/time_limit.txt
+expect_output time_limit $timed tests/expected/time_limit.txt
+expect_output time_limit_quantum_1 $timed tests/expected/time_limit.txt --quantum=1 --output-order=deck
+expect_output time_limit_quantum_3 $timed tests/expected/time_limit.txt --quantum=3 --output-order=deck
+expect_output time_limit_general_loop $timed tests/expected/time_limit.txt --no-threaded-core
+expect_output time_limit_async $timed tests/expected/time_limit.txt --async-io --io-latency=7 --output-order=deck
+if "$mos" --log=info --input=$timed --output="$work/time_idle.txt" --output-order=deck --async-io \
+       --io-latency=200000 | grep -q 'CPU utilization 0\.00' &&
+   cmp -s "$work/time_idle.txt" tests/expected/time_limit.txt; then
+    pass time_limit_idle_skip
+else
+    fail time_limit_idle_skip
+fi
+
+# Data cards: leading and trailing blanks, an empty card, a card past 40
+# columns, and GD after the last card, read from the mapping, line by line
+# and from the in-memory streams of a sharded run
+expect_output data_cards tests/decks/data_cards.txt tests/expected/data_cards.txt
+expect_output data_cards_stream tests/decks/data_cards.txt tests/expected/data_cards.txt --no-mmap
+expect_output data_cards_shards tests/decks/data_cards.txt tests/expected/data_cards.txt --shards=3
+
+# Translated blocks: a hot loop's block is cached, then SR rewrites one of
+# its words. The next entry must run the new word (H) rather than the
+# cached branch, which would loop until the time limit.
+hot=tests/decks/hot_loop_rewrite.txt
+expect_output hot_loop_rewrite $hot tests/expected/hot_loop_rewrite.txt
+expect_output hot_loop_rewrite_uncached $hot tests/expected/hot_loop_rewrite.txt --no-block-cache
+if "$mos" --log=info --input=$hot --output="$work/hot.txt" | grep -q '^\[INFO\] Translation cache: [1-9]'; then
+    pass hot_loop_translated
+else
+    fail hot_loop_translated
+fi
+
+# Interrupts raised by the same instruction: each job's last instruction
+# also reaches its time limit. GD and PD finish before the timer ends the
+# job, a page fault is serviced and the instruction retried first, and
+# opcode, operand and line-limit errors are reported instead of the timer.
+# With a quantum of 1 the slice also expires there, which only delays the
+# job's end until it next runs.
+expect_output interrupt_order tests/decks/interrupt_order.txt tests/expected/interrupt_order.txt
+expect_output interrupt_order_quantum_1 tests/decks/interrupt_order.txt tests/expected/interrupt_order.txt \
+    --quantum=1 --output-order=deck
+
+# Code overwritten by GD or SR runs as written, not as first decoded: each
+# job halts at once unless the rewritten word is decoded afresh
+expect_output self_modify tests/decks/self_modify.txt tests/expected/self_modify.txt
+expect_output self_modify_general_loop tests/decks/self_modify.txt tests/expected/self_modify.txt \
+    --no-threaded-core --no-block-cache
+
+# Two resident jobs with the same $AMJ pid must not share translations
+expect_output duplicate_pid tests/decks/duplicate_pid.txt tests/expected/duplicate_pid.txt --frames=30
+# The same with shared code, so their hot loops map to the same cached block
+expect_output duplicate_pid_shared tests/decks/duplicate_pid_shared.txt tests/expected/duplicate_pid_shared.txt \
+    --share-pages
+expect_failure share_pages_eager input.txt "Page sharing needs demand paging" --share-pages --no-demand-paging
+
+# Four resident copies of one two-page program: sharing maps them onto one
+# copy, so fewer frames are ever in use and the output does not change
+repeated=tests/decks/repeated_program.txt
+expect_output repeated_program $repeated tests/expected/repeated_program.txt --frames=40 --admit=free
+expect_output repeated_program_shared $repeated tests/expected/repeated_program.txt --frames=40 --admit=free \
+    --share-pages
+peak_frames() {
+    "$mos" --log=info --input=$repeated --output="$work/peak.txt" --frames=40 --admit=free "$@" |
+        sed -n 's/^\[INFO\] Paging .*, peak frames \([0-9]*\)$/\1/p'
+}
+unshared=$(peak_frames)
+shared=$(peak_frames --share-pages)
+if [ -n "$unshared" ] && [ -n "$shared" ] && [ "$shared" -lt "$unshared" ] &&
+   "$mos" --log=info --input=$repeated --output="$work/peak.txt" --frames=40 --admit=free --share-pages |
+       grep -q '^\[INFO\] Page sharing: 6 shared mappings'; then
+    pass share_pages_frames
+else
+    fail share_pages_frames
+fi
+
+# mixed_jobs: eight generated looping jobs, four of which end abnormally
+mixed=tests/decks/mixed_jobs.txt
+
+# Context switches: with a quantum of 1 the four jobs alternate after every
+# instruction, so any R, C or IC left behind by one job would show up in
+# another's path or output. Page faults under --frames=8 restart the
+# faulted instruction in the same slice.
+for quantum in 1 2; do
+    expect_output context_switch_$quantum tests/decks/context_switch.txt tests/expected/context_switch.txt \
+        --quantum=$quantum --frames=20 --output-order=deck
+    expect_output mixed_quantum_$quantum $mixed tests/expected/mixed_jobs_deck_order.txt --quantum=$quantum \
+        --frames=8 --admit=free --output-order=deck
+done
+
+# Schedulers: four jobs of 2, 3, 10 and 30 iterations, with priorities
+# 5, 0, 1 and 9 and time limits of 100, 40, 500 and 260 ticks. Each
+# policy finishes them in its own order, and prints the same for each job.
+sched=tests/decks/sched_jobs.txt
+finish_order() {
+    "$mos" --log=off --input=$sched --output="$work/sched.txt" --frames=40 "$@" > /dev/null &&
+        grep '^Process [0-9]* terminated' "$work/sched.txt" | cut -d' ' -f2 | tr '\n' ' '
+}
+for case in "rr:3 4 2 1" "priority:4 2 3 1" "srt:4 3 1 2" "mlfq:3 4 2 1"; do
+    policy=${case%%:*}
+    if [ "$(finish_order --sched=$policy)" = "${case#*:} " ]; then
+        pass sched_order_$policy
+    else
+        fail sched_order_$policy
+    fi
+    expect_output sched_$policy $sched tests/expected/sched_jobs.txt --frames=40 --sched=$policy --output-order=deck
+done
+# One MLFQ level is round-robin at the base quantum
+if [ "$(finish_order --sched=mlfq --mlfq-levels=1)" = "$(finish_order --sched=rr)" ]; then
+    pass sched_mlfq_one_level
+else
+    fail sched_mlfq_one_level
+fi
+
+# TLB: with 8 frames, a quantum of 1 and two CPUs, pages are evicted
+# under cached translations and jobs move between CPUs every tick. Stale
+# entries would read another page, so the output would change.
+if "$mos" --log=info --input=$mixed --output="$work/tlb.txt" --frames=8 --admit=free --cpus=2 --quantum=1 \
+       --output-order=deck | grep -q '^\[INFO\] TLB hits: [1-9]' &&
+   cmp -s "$work/tlb.txt" tests/expected/mixed_jobs_deck_order.txt; then
+    pass tlb_invalidation
+else
+    fail tlb_invalidation
+fi
+
+# Free-frame bitmap: the four jobs fill all 16 frames exactly, wherever the
+# search starts, so no page is evicted. Random placement over several
+# bitmap words leaves the output alone.
+for seed in 0 3 11; do
+    placement=""
+    [ $seed -gt 0 ] && placement="--random-frames --seed=$seed"
+    if "$mos" --log=info --input=$repeated --output="$work/fill_$seed.txt" --frames=16 --admit=free $placement |
+           grep -q 'evictions 0, .*, peak frames 16$' &&
+       cmp -s "$work/fill_$seed.txt" tests/expected/repeated_program.txt; then
+        pass frame_fill_$seed
+    else
+        fail frame_fill_$seed
+    fi
+    [ $seed -gt 0 ] && expect_output random_frames_$seed $mixed tests/expected/mixed_jobs_deck_order.txt \
+        --frames=130 $placement --output-order=deck
+done
+
+# Input spooler: parsing on its own thread or inline, with room for one job
+# or many, from the mapping or line by line, admits the same jobs in the
+# same order
+expect_output spool_inline $mixed tests/expected/mixed_jobs_free.txt --frames=8 --admit=free --no-background-spool
+expect_output spool_one_job $mixed tests/expected/mixed_jobs_free.txt --frames=8 --admit=free --spool-capacity=1
+expect_output spool_one_job_stream $mixed tests/expected/mixed_jobs_free.txt --frames=8 --admit=free \
+    --spool-capacity=1 --no-mmap
+
+# Page replacement: eight frames are far too few, so every policy evicts
+# and swaps through the drum, and the output is the same under each.
+# Without replacement, a job whose fault finds no free frame ends there.
+for policy in clock lru fifo; do
+    if "$mos" --log=info --input=$mixed --output="$work/replace_$policy.txt" --frames=8 --admit=free \
+           --replace=$policy | grep -q "^\[INFO\] Paging ($policy): .*swap-outs [1-9][0-9]*, swap-ins [1-9]" &&
+       cmp -s "$work/replace_$policy.txt" tests/expected/mixed_jobs_free.txt; then
+        pass replace_$policy
+    else
+        fail replace_$policy
+    fi
+done
+expect_output replace_none $mixed tests/expected/mixed_jobs_no_replace.txt --frames=8 --admit=free --replace=none
+# --paging-report adds one line of counts to each job's report and nothing else
+if "$mos" --log=off --input=$mixed --output="$work/paging_report.txt" --frames=8 --admit=free --paging-report \
+       > /dev/null &&
+   [ "$(grep -c '^Page faults: [0-9]*, Swap-ins: [0-9]* (clock)$' "$work/paging_report.txt")" -eq 8 ] &&
+   grep -v '^Page faults: ' "$work/paging_report.txt" | cmp -s - tests/expected/mixed_jobs_free.txt; then
+    pass paging_report
+else
+    fail paging_report
+fi
+
+# Async I/O: jobs block on the channels and the order they finish in
+# shifts, but each job's output does not, on one CPU or several
+expect_output async_io $mixed tests/expected/mixed_jobs_async.txt --async-io --io-latency=5 --admit=free --frames=8
+expect_output async_io_cpus $mixed tests/expected/mixed_jobs_deck_order.txt --async-io --io-latency=5 --cpus=4 \
+    --async-printer --output-order=deck --admit=free --frames=8
+
+# Two jobs print the same shared page on the channel; the first completion
+# must not unpin the frame while the second transfer still reads it
+expect_output shared_print_pin tests/decks/shared_print_pin.txt tests/expected/shared_print_pin.txt \
+    --async-io --io-latency=10 --share-pages --frames=6
+
+# Extended ISA: a counting loop, signed subtract, out-of-range and
+# non-numeric operands, and BU. The same deck on the legacy decoder
+# stops each job at its first extended opcode.
+ext=tests/decks/extended_isa.txt
+expect_output extended_isa $ext tests/expected/extended_isa.txt --extended-isa
+expect_output extended_isa_general_loop $ext tests/expected/extended_isa.txt --extended-isa \
+    --no-threaded-core --no-block-cache
+expect_output extended_isa_legacy $ext tests/expected/extended_isa_legacy.txt
+
+# MV over page ranges: disjoint, overlapping, past the end, and one page
+expect_output move_pages tests/decks/move_pages.txt tests/expected/move_pages.txt --extended-isa
+# A move needs one source and one target frame at a time and resumes at the
+# page a fault stopped it on, so four frames are enough, even at a quantum
+# of 1, and an overlapping move still copies as memmove does
+for frames in 4 5; do
+    expect_output move_pages_frames_$frames tests/decks/move_pages.txt tests/expected/move_pages_deck_order.txt \
+        --extended-isa --frames=$frames --quantum=1 --output-order=deck
+done
+# With three frames no move can run, and each is an operand error
+if "$mos" --log=off --input=tests/decks/move_pages.txt --output="$work/move_three.txt" --extended-isa --frames=3 \
+       > /dev/null &&
+   [ "$(grep -c 'terminated: Invalid operand$' "$work/move_three.txt")" -eq "$(grep -c terminated "$work/move_three.txt")" ]; then
+    pass move_pages_three_frames
+else
+    fail move_pages_three_frames
+fi
+# A four-page move beside a resident job gets the result it gets alone: on
+# one CPU, on two, and in its own shard
+neighbour=tests/decks/move_pages_neighbour.txt
+expect_output move_pages_neighbour $neighbour tests/expected/move_pages_neighbour.txt --extended-isa --output-order=deck
+expect_output move_pages_neighbour_cpus $neighbour tests/expected/move_pages_neighbour.txt --extended-isa --cpus=2 \
+    --output-order=deck
+expect_output move_pages_neighbour_shards $neighbour tests/expected/move_pages_neighbour.txt --extended-isa --shards=2
+
+# Checkpoint/restore: resuming from a mid-run checkpoint, with several jobs
+# resident and pages on the drum, finishes with the uninterrupted output.
+# The stale tail stands in for output printed after the checkpoint.
+if "$mos" --log=off --input=$mixed --output="$work/ck_run.txt" --frames=8 --admit=free \
+       --checkpoint="$work/ck.bin" --checkpoint-interval=250 > /dev/null &&
+   cmp -s "$work/ck_run.txt" tests/expected/mixed_jobs_free.txt &&
+   { cat "$work/ck_run.txt"; echo stale; } > "$work/ck_restored.txt" &&
+   "$mos" --log=off --input=$mixed --output="$work/ck_restored.txt" --frames=8 --admit=free \
+       --restore="$work/ck.bin" > /dev/null &&
+   cmp -s "$work/ck_restored.txt" tests/expected/mixed_jobs_free.txt; then
+    pass checkpoint_restore
+else
+    fail checkpoint_restore
+fi
+
+# The same under the other policies, whose queues carry levels, priorities
+# and remaining times; restoring under another policy is refused
+for policy in priority srt mlfq; do
+    if "$mos" --log=off --input=$mixed --output="$work/ck_ref_$policy.txt" --frames=8 --admit=free \
+           --sched=$policy > /dev/null &&
+       "$mos" --log=off --input=$mixed --output="$work/ck_run_$policy.txt" --frames=8 --admit=free \
+           --sched=$policy --checkpoint="$work/ck_$policy.bin" --checkpoint-interval=250 > /dev/null &&
+       { cat "$work/ck_run_$policy.txt"; echo stale; } > "$work/ck_restored_$policy.txt" &&
+       "$mos" --log=off --input=$mixed --output="$work/ck_restored_$policy.txt" --frames=8 --admit=free \
+           --sched=$policy --restore="$work/ck_$policy.bin" > /dev/null &&
+       cmp -s "$work/ck_run_$policy.txt" "$work/ck_ref_$policy.txt" &&
+       cmp -s "$work/ck_restored_$policy.txt" "$work/ck_ref_$policy.txt"; then
+        pass checkpoint_restore_$policy
+    else
+        fail checkpoint_restore_$policy
+    fi
+done
+cp "$work/ck_run_mlfq.txt" "$work/checkpoint_policy_mismatch.txt"
+expect_failure checkpoint_policy_mismatch $mixed "different memory or scheduling options" --frames=8 --admit=free \
+    --restore="$work/ck_mlfq.bin"
+
+# Sharded runs print what one MOS does in deck order, whatever the cut
+expect_output deck_order $mixed tests/expected/mixed_jobs_deck_order.txt --output-order=deck --admit=free --frames=8
+for shards in 1 3 8; do
+    expect_output shards_$shards $mixed tests/expected/mixed_jobs_deck_order.txt --shards=$shards --shard-threads=2 \
+        --admit=free --frames=8
+done
+expect_failure shards_termination $mixed "always prints in deck order" --shards=2 --output-order=termination
+# Against the default sequential run: the sample deck finishes in deck order
+# anyway, and for the mixed deck each job's block is the same, only reordered
+expect_output shards_sample input.txt output.txt --shards=2
+job_blocks() {
+    awk '{ block = block $0 "|" } /^TTC:/ { print block; block = "" }' "$1" | sort
+}
+job_blocks tests/expected/mixed_jobs_free.txt > "$work/sequential_blocks.txt"
+if "$mos" --log=off --input=$mixed --output="$work/sharded.txt" --shards=3 --admit=free --frames=8 > /dev/null &&
+   job_blocks "$work/sharded.txt" > "$work/sharded_blocks.txt" &&
+   [ "$(wc -l < "$work/sequential_blocks.txt")" -eq 8 ] &&
+   cmp -s "$work/sharded_blocks.txt" "$work/sequential_blocks.txt"; then
+    pass shards_sequential_blocks
+else
+    fail shards_sequential_blocks
+fi
+
+# Output spooling: a job that fills its buffer sends it early and holds the
+# printer, so others wait and the order shifts, but every job still
+# prints as one unbroken block
+expect_output async_printer $mixed tests/expected/mixed_jobs_free.txt --frames=8 --admit=free --async-printer
+for buffer in 1 16; do
+    if "$mos" --log=off --input=$mixed --output="$work/buffer_$buffer.txt" --frames=8 --admit=free \
+           --output-buffer=$buffer --async-printer > /dev/null &&
+       job_blocks "$work/buffer_$buffer.txt" | cmp -s - "$work/sequential_blocks.txt"; then
+        pass output_buffer_$buffer
+    else
+        fail output_buffer_$buffer
+    fi
+done
+expect_output output_buffer_deck_order $mixed tests/expected/mixed_jobs_deck_order.txt --frames=8 --admit=free \
+    --output-buffer=1 --output-order=deck
+
+# Trace ring: the fault dumps decode, and replay reproduces them from the
+# start of the deck and from the checkpoint the first one pinned
+trace_run() {
+    "$mos" --log=off --input=$mixed --trace-ring=64 "$@"
+}
+if trace_run --output="$work/traced.txt" --trace-file="$work/trace.bin" \
+       --checkpoint="$work/tr.bin" --checkpoint-interval=100 > /dev/null &&
+   "$mos" --decode-trace="$work/trace.bin" > "$work/decoded.txt" &&
+   [ "$(grep -c '^Dump [0-9]*: CPU 0, fault in pid' "$work/decoded.txt")" -eq 3 ] &&
+   trace_run --output="$work/replayed.txt" --replay-trace="$work/trace.bin" |
+       grep -q '^Replay reproduced all 64 trace records' &&
+   cp "$work/traced.txt" "$work/replayed.txt" &&
+   trace_run --output="$work/replayed.txt" --restore="$work/tr.bin.replay" --replay-trace="$work/trace.bin" |
+       grep -q '^Replay reproduced all' &&
+   cmp -s "$work/replayed.txt" "$work/traced.txt"; then
+    pass trace_replay
+else
+    fail trace_replay
+fi
+
+# Working-set admission: job 2's code alone needs more frames than memory
+# has, so it is reported as exceeding memory and the batch carries on. The
+# summary counts it apart from the three jobs that ran.
+expect_output admission tests/decks/admission.txt tests/expected/admission.txt --no-demand-paging --frames=4
+if "$mos" --log=info --input=tests/decks/admission.txt --output="$work/admission_info.txt" \
+       --no-demand-paging --frames=4 --admit=working-set |
+       grep 'Scheduling (rr, admit working-set' | grep ': 3 jobs,' | grep -q ', 1 rejected$'; then
+    pass admission_summary
+else
+    fail admission_summary
+fi
+
+# Performance counters: one CSV record per job and one of totals. The
+# instructions a job retired add up to its TTC, and the totals add up the
+# jobs. JSON carries the same records.
+perf_run() {
+    "$mos" --log=off --input=$sched --output="$work/perf.txt" --frames=40 --perf=$1 --perf-file="$work/perf.$1" \
+        > /dev/null
+}
+if perf_run csv &&
+   awk '/^Process/ { pid = $2 } /^TTC:/ { sub(",", "", $2); print pid, $2 }' "$work/perf.txt" | sort > "$work/ttc.txt" &&
+   awk -F, '$1 == "job" { n = 0; for (i = 5; i <= 17; i++) n += $i; print $4, n }' "$work/perf.csv" |
+       sort | cmp -s - "$work/ttc.txt" &&
+   [ "$(wc -l < "$work/ttc.txt")" -eq 4 ] &&
+   awk -F, '$1 == "job" { for (i = 5; i <= 29; i++) sum[i] += $i }
+            $1 == "total" { for (i = 5; i <= 29; i++) if (sum[i] != $i) bad = 1; totals++ }
+            END { exit bad || totals != 1 }' "$work/perf.csv" &&
+   perf_run json &&
+   [ "$(grep -c '^{"type":"job","tick":[0-9]*,"cycles":[0-9]*,"pid":[1-4],' "$work/perf.json")" -eq 4 ] &&
+   [ "$(grep -c '^{"type":"total",' "$work/perf.json")" -eq 1 ]; then
+    pass perf_counters
+else
+    fail perf_counters
+fi
+
+# Kernel errors end the run instead of being swallowed
+expect_failure checkpoint_unwritable input.txt "Failed to write checkpoint" \
+    --checkpoint=/nonexistent/ck.bin --checkpoint-interval=1000
+expect_failure bad_job_card tests/decks/bad_job_card.txt "System error" --frames=4 --no-background-spool
+
+# Benchmark: the generated deck and its output land in the working
+# directory. The abnormal count matches the injected faults the output
+# reports, and the deck run on its own prints the same output.
+mkdir "$work/bench"
+if (cd "$work/bench" &&
+    "$mos" --bench --bench-jobs=20 --bench-body=8 --bench-iterations=5 --bench-faults=50 --bench-runs=2 \
+        --seed=5 > report.txt &&
+    [ "$(grep -c '^run [12]: .* (20 jobs, [0-9]* abnormal)$' report.txt)" -eq 2 ] &&
+    abnormal=$(grep -c 'terminated: ' bench_output.txt) &&
+    abnormal=$((abnormal - $(grep -c 'terminated: Normal termination' bench_output.txt))) &&
+    [ "$abnormal" -gt 0 ] && grep -q "^run 1: .* (20 jobs, $abnormal abnormal)$" report.txt &&
+    "$mos" --log=off --input=bench_input.txt --output=rerun.txt > /dev/null &&
+    cmp -s rerun.txt bench_output.txt); then
+    pass bench
+else
+    fail bench
+fi
+
+# Multiple CPUs: 64 generated jobs spread over four CPUs print what one CPU
+# prints in deck order, retire as many instructions as on two CPUs, and
+# CPUs that run dry steal from the others. Which CPU runs what varies.
+mkdir "$work/cpus"
+cpu_totals() {
+    "$mos" --log=info --input=bench_input.txt --output="cpus_$1.txt" --frames=200 --cpus=$1 --output-order=deck |
+        awk '/^\[INFO\] CPU [0-9]*:/ { n += $4; s += $6 } END { print n, s }'
+}
+if (cd "$work/cpus" &&
+    "$mos" --bench --bench-jobs=64 --bench-body=8 --bench-iterations=40 --seed=2 --frames=200 > /dev/null &&
+    "$mos" --log=off --input=bench_input.txt --output=cpus_1.txt --frames=200 --output-order=deck > /dev/null &&
+    four=$(cpu_totals 4) && two=$(cpu_totals 2) &&
+    [ "${four% *}" = "${two% *}" ] && [ "${four#* }" -gt 0 ] &&
+    cmp -s cpus_4.txt cpus_1.txt && cmp -s cpus_2.txt cpus_1.txt); then
+    pass cpus_work_stealing
+else
+    fail cpus_work_stealing
+fi
+
+# Threaded core: the switch-dispatched build, the computed-goto one and
+# the general loop alone all run the same programs
+g++ -std=c++17 -O2 -Wall -Wextra -pthread -DMOS_COMPUTED_GOTO=0 -o "$work/mos_switch" MOS_Phase_3.cpp
+for core in switch goto general; do
+    run="$mos"
+    options=""
+    [ $core = switch ] && run="$work/mos_switch"
+    [ $core = general ] && options="--no-threaded-core"
+    if "$run" --log=off --input=$mixed --output="$work/core_$core.txt" --frames=8 --admit=free $options \
+           > /dev/null &&
+       cmp -s "$work/core_$core.txt" tests/expected/mixed_jobs_free.txt &&
+       "$run" --log=off --input=tests/decks/context_switch.txt --output="$work/core_cs_$core.txt" --quantum=1 \
+           --frames=20 --output-order=deck $options > /dev/null &&
+       cmp -s "$work/core_cs_$core.txt" tests/expected/context_switch.txt; then
+        pass threaded_core_$core
+    else
+        fail threaded_core_$core
+    fi
+done
+
+# Process table: 150 resident jobs fill three 64-slot blocks. Priority
+# scheduling reads its keys from every block, so jobs end in priority
+# order, and every policy prints the same per job as a sharded run.
+mkdir "$work/pool"
+if (cd "$work/pool" &&
+    "$mos" --bench --bench-jobs=150 --bench-body=4 --bench-iterations=3 --seed=4 --frames=1000 --admit=free \
+        > /dev/null &&
+    "$mos" --log=off --input=bench_input.txt --output=priority.txt --frames=1000 --admit=free --sched=priority \
+        > /dev/null &&
+    awk 'NR == FNR { if (/^\$AMJ/) priority[substr($0, 5, 4) + 0] = substr($0, 17); next }
+         /^Process/ { print priority[$2] }' bench_input.txt priority.txt > priorities.txt &&
+    [ "$(wc -l < priorities.txt)" -eq 150 ] && sort -c -n priorities.txt &&
+    for policy in rr priority; do
+        "$mos" --log=off --input=bench_input.txt --output=$policy.txt --frames=1000 --admit=free --sched=$policy \
+            --output-order=deck > /dev/null || exit 1
+    done &&
+    "$mos" --log=off --input=bench_input.txt --output=shards.txt --shards=5 --frames=1000 --admit=free > /dev/null &&
+    cmp -s rr.txt shards.txt && cmp -s priority.txt shards.txt); then
+    pass process_table_blocks
+else
+    fail process_table_blocks
+fi
+
+# Word and frame moves: a build without SSE2 falls back to word-at-a-time
+# copies and clears and prints the same. The mixed deck swaps frames
+# through the drum, and MV copies page ranges.
+g++ -std=c++17 -O2 -Wall -Wextra -pthread -U__SSE2__ -o "$work/mos_scalar" MOS_Phase_3.cpp
+if "$work/mos_scalar" --log=off --input=$mixed --output="$work/scalar_mixed.txt" --frames=8 --admit=free \
+       > /dev/null &&
+   cmp -s "$work/scalar_mixed.txt" tests/expected/mixed_jobs_free.txt &&
+   "$work/mos_scalar" --log=off --input=tests/decks/move_pages.txt --output="$work/scalar_mv.txt" --extended-isa \
+       > /dev/null &&
+   cmp -s "$work/scalar_mv.txt" tests/expected/move_pages.txt &&
+   "$work/mos_scalar" --log=off --input=$ext --output="$work/scalar_ext.txt" --extended-isa > /dev/null &&
+   cmp -s "$work/scalar_ext.txt" tests/expected/extended_isa.txt; then
+    pass scalar_words
+else
+    fail scalar_words
+fi
+
+# Logging compiled out: the deck prints the same, and --log=trace has
+# nothing to show above the build's ceiling
+log_build() {
+    g++ -std=c++17 -O2 -Wall -Wextra -pthread -DMOS_LOG_LEVEL=$1 -o "$work/mos_log$1" MOS_Phase_3.cpp &&
+        "$work/mos_log$1" --log=trace --input=input.txt --output="$work/log$1.txt" > "$work/log$1.out" &&
+        cmp -s "$work/log$1.txt" output.txt
+}
+if log_build 0 && [ "$(cat "$work/log0.out")" = "System shutdown normally" ] &&
+   log_build 2 && grep -q '^\[INFO\] ' "$work/log2.out" && ! grep -q '^\[DEBUG\] ' "$work/log2.out"; then
+    pass log_compiled_out
+else
+    fail log_compiled_out
+fi
+
+# Embedding: the jobOutput callback sees every job by a unique jobId
+if g++ -std=c++17 -O2 -Wall -Wextra -pthread -o "$work/embed_test" tests/embed_test.cpp &&
+   "$work/embed_test" tests/decks/duplicate_pid.txt > /dev/null; then
+    pass embed_callback
+else
+    fail embed_callback
+fi
+
+# Service mode: decks and replies on stdin/stdout, each closed by $EOD
+{ cat input.txt; echo '$EOD'; cat tests/decks/duplicate_pid.txt; echo '$EOD'; } > "$work/serve_in.txt"
+{ cat output.txt; echo '$EOD'; cat tests/expected/duplicate_pid.txt; echo '$EOD'; } > "$work/serve_expected.txt"
+if "$mos" --serve --frames=30 < "$work/serve_in.txt" > "$work/serve_out.txt" &&
+   cmp -s "$work/serve_out.txt" "$work/serve_expected.txt"; then
+    pass serve_stdin
+else
+    fail serve_stdin
+fi
+
+[ "$failures" -eq 0 ] && echo "All tests passed" || echo "$failures failed"
+[ "$failures" -eq 0 ]